@@ -11,7 +11,7 @@ VERSION = 0.9.0
 
 QMAKE_CXXFLAGS_DEBUG += -Werror
 
-LIBS += -lsndfile -lfftw3 -lm -L/usr/lib -lrtaudio
+LIBS += -lsndfile -lfftw3 -lfftw3f -lm -L/usr/lib -lrtaudio
 unix {
 	CONFIG += link_pkgconfig
 	PKGCONFIG += rtaudio
@@ -54,9 +54,17 @@ HEADERS += MainWindow.hxx \
 					 MyListView.hxx \
            detect/Audio.hxx \
            detect/detect.hxx \
+           detect/DistanceMatrix.hxx \
            detect/Files.hxx \
            detect/Filter.hxx \
+           detect/Geometry.hxx \
+           detect/LearningMatrix.hxx \
            detect/Manager.hxx \
+           detect/Quantized.hxx \
+           detect/Simd.hxx \
+           detect/Spectral.hxx \
+           detect/ThreadPool.hxx \
+           detect/VPTree.hxx \
            Drawers/AudioDraw.hxx \
            Drawers/EnergyDraw.hxx \
            Drawers/EnergyDrawWidget.hxx \
@@ -79,9 +87,16 @@ SOURCES += MainWindow.cpp \
 					 ComparisonWindow.cpp \
            detect/Audio.cpp \
            detect/detect.cpp \
+           detect/DistanceMatrix.cpp \
            detect/Files.cpp \
            detect/Filter.cpp \
+           detect/Geometry.cpp \
+           detect/LearningMatrix.cpp \
            detect/Manager.cpp \
+           detect/Quantized.cpp \
+           detect/Spectral.cpp \
+           detect/ThreadPool.cpp \
+           detect/VPTree.cpp \
            Drawers/AudioDraw.cpp \
            Drawers/EnergyDraw.cpp \
            Drawers/EnergyDrawWidget.cpp \
@@ -22,17 +22,8 @@
 
 using namespace std;
 
-struct CCompareResults{
-	double diff;
-	CSample *sample;
-};
-
-bool operator<(const CCompareResults &a, const CCompareResults &b){
-		return a.diff < b.diff;
-}
-
 uint ComparisonWindow::COUNT = 5;
-ComparisonWindow::ComparisonWindow(QWidget *parent, CSample* sample, vector<CSample*>& learn) : QDialog(parent) {
+ComparisonWindow::ComparisonWindow(QWidget *parent, CSample* sample, const CLearningMatrix& learn) : QDialog(parent) {
 	setupUi(this);
 	spectroDraw->setSample(sample, false);
 	QVBoxLayout * myVBox = new QVBoxLayout(frame);
@@ -40,26 +31,22 @@ ComparisonWindow::ComparisonWindow(QWidget *parent, CSample* sample, vector<CSam
 	myVBox->setContentsMargins(1, 1, 1, 1);
 	myVBox->setObjectName(QString::fromUtf8("myVBox"));
 
-	vector<CCompareResults> cr(learn.size());
-	for (uint i=0; i<learn.size(); i++){
-		cr[i].sample = learn[i];
-		cr[i].diff = cr[i].sample->differ(*sample);
-	}
-	sort (cr.begin(), cr.end());
-	spectros.resize(COUNT);
+	vector<SNeighbour> cr = learn.nearestK(*sample, COUNT);
+	spectros.resize(cr.size());
 	QString txt;
-	for (uint i=0; i<COUNT; i++){
+	for (uint i=0; i<cr.size(); i++){
+		CSample* match = learn.getSample(cr[i].index);
 		spectros[i] = new SpectroDraw(frame);
 		spectros[i]->setObjectName(QString("learningSpectro") + QString::number(i));
     spectros[i]->setMinimumSize(QSize(250, 160));
-		spectros[i]->setSample(cr[i].sample, false);
-		QString desc = QString("%1 (%2)").arg(cr[i].sample->getName().c_str()).arg(cr[i].diff, 0, 'g', 3);
+		spectros[i]->setSample(match, false);
+		QString desc = QString("%1 (%2)").arg(match->getName().c_str()).arg(cr[i].diff, 0, 'g', 3);
 		spectros[i]->setDescription(desc.toStdString().c_str());
 		myVBox->addWidget(spectros[i]);
 		txt += QString("Spectro%1 (%2)\n").arg(i).arg(cr[i].diff);
-		int count = min(cr[i].sample->getFreqCount(), sample->getFreqCount());
+		int count = min(match->getFreqCount(), sample->getFreqCount());
 		for (int j=0; j<count; j++){
-			double tmp = sample->getFrequencies()[j].differ(cr[i].sample->getFrequencies()[j]);
+			double tmp = sample->getFrequencies()[j].differ(match->getFrequencies()[j]);
 			txt += QString("[%1] = %2\n").arg(j).arg(tmp);
 		}
 		txt += '\n';
@@ -23,6 +23,7 @@
 #include "ui_ComparisonWindow.h"
 #include <vector>
 #include "Audio.hxx"
+#include "LearningMatrix.hxx"
 
 // Note: Do not use "using namespace std" in headers
 // Use std:: prefix explicitly to avoid namespace pollution
@@ -32,7 +33,7 @@ class ComparisonWindow : public QDialog, public Ui::ComparisonWindow {
 
 	public:
 		static uint COUNT;
-		ComparisonWindow(QWidget *parent, CSample* sample, std::vector<CSample*>& learn);
+		ComparisonWindow(QWidget *parent, CSample* sample, const CLearningMatrix& learn);
 		~ComparisonWindow();
 	protected:
 
@@ -376,8 +376,7 @@ void MainWindow::selectedCSample(CSample* sample){
 	segmentDraw->setSignal(selectedFrames);
 	spectrogram->setSample(sample, true);
 	normalizedSpectrogram->setSample(sample, false);
-	auto learningRaw = toRawSamples(learning);
-	CSample * bestMatch = test(sample, learningRaw);
+	CSample * bestMatch = test(sample, learningMatrix);
 	if (bestMatch != NULL){
 		bestMatchSpectrogram->setSample(bestMatch, false);
 		QString desc = QString("%1 (%2)").arg(bestMatch->getName().c_str()).arg(sample->differ(*bestMatch), 0, 'g', 3);
@@ -401,6 +400,7 @@ void MainWindow::selectedSamples(int start, int end){
 }
 
 void MainWindow::loadLearningClicked(){
+	learningMatrix.clear();
 	learning.clear();
 	const QString& filename = learningDirectoryEdt->text();
 	statusBar()->showMessage("Loading learning set, please wait...");
@@ -408,6 +408,7 @@ void MainWindow::loadLearningClicked(){
 	progressBar->setMaximum(100);
 	progressBar->setValue(0);
 	learning = readLearning(filename.toStdString().c_str(), manager, progressBar);
+	learningMatrix.add(toRawSamples(learning));
 	printf("Learning set size: %d\n", (int)learning.size());
 	statusBar()->showMessage("");
 	progressBar->setMaximum(100);
@@ -490,8 +491,7 @@ void MainWindow::openCompareWindow(){
 			return;
 		}
 	}
-	auto learningRaw = toRawSamples(learning);
-	ComparisonWindow compWindow(this, sample_tmp.get(), learningRaw);
+	ComparisonWindow compWindow(this, sample_tmp.get(), learningMatrix);
 	compWindow.exec();
 }
 
@@ -546,7 +546,11 @@ void MainWindow::openLearningEditor(){
 	LearningListModel llmodel(learning, this);
 	dial.learningList->setModel(&llmodel);
 	dial.connectAll();
-	if (dial.exec() == QDialog::Accepted){
+	bool accepted = dial.exec() == QDialog::Accepted;
+	// Samples may have been removed in the editor
+	learningMatrix.clear();
+	learningMatrix.add(toRawSamples(learning));
+	if (accepted){
 		printf("Saving...\n");
 		auto learningRaw = toRawSamples(learning);
 		saveSamplesToFile(learningRaw, "saved.freq");
@@ -563,7 +567,9 @@ void MainWindow::readLearningFile(){
 			"./",
 			"Learning set (*.freq)");
 	if (s != ""){
+		learningMatrix.clear();
 		learning = readLearningFromFile(s.toStdString().c_str());
+		learningMatrix.add(toRawSamples(learning));
 #ifdef __DEBUG__
 		printf("Read %d samples\n", learning.size());
 #endif
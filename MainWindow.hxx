@@ -30,6 +30,7 @@
 
 #include "detect/Files.hxx"
 #include "detect/Filter.hxx"
+#include "detect/LearningMatrix.hxx"
 #include "detect/Manager.hxx"
 #include "SettingsDialog.hxx"
 #include "ComparisonWindow.hxx"
@@ -77,6 +78,7 @@ class MainWindow : public QMainWindow, private Ui::MainWindow {
 		CFFT fft;
 		CManager manager;
 		std::vector<std::unique_ptr<CSample>> learning;
+		CLearningMatrix learningMatrix;	//packed copy of learning for best match search
 		std::vector<double> selectedFrames;
 		std::vector<std::unique_ptr<CSpectColor>> colorerList;
 		std::unique_ptr<ColorListModel> colorsModel;
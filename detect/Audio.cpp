@@ -19,9 +19,12 @@
 
 #include "Audio.hxx"
 #include "detect.hxx"
+#include "Spectral.hxx"
+#include "Geometry.hxx"
 #include <array>
 #include <cassert>
 #include <cstring>
+#include <limits>
 #include <stdexcept>
 
 using namespace std;
@@ -80,9 +83,9 @@ void CSignal::saveAudio(const string& filename){
 CSample::CSample(const string& filename, CFFT* fft) : CSignal(filename) {
 	birdId = birdIdFromName(getName());
 	if (fft != nullptr){
-		computeFrequencies(*fft, frames.data(), frequencies, origFrequencies, frames.size());
+		computeFrequencies(*fft, frames.data(), frequencies, frames.size());
 	} else {
-		computeFrequencies(frames.data(), frequencies, origFrequencies, frames.size());
+		computeFrequencies(frames.data(), frequencies, frames.size());
 	}
 	isNull = false;
 	normalize();
@@ -96,9 +99,9 @@ CSample::CSample(double* _frames, int n, uint _sampleRate, uint _id, uint start,
 	sampleRate = _sampleRate;
 	frames.assign(_frames, _frames + n);
 	if (fft != nullptr){
-		computeFrequencies(*fft, frames.data(), frequencies, origFrequencies, frames.size());
+		computeFrequencies(*fft, frames.data(), frequencies, frames.size());
 	} else {
-		computeFrequencies(frames.data(), frequencies, origFrequencies, frames.size());
+		computeFrequencies(frames.data(), frequencies, frames.size());
 	}
 	isNull = false;
 	normalize();
@@ -116,9 +119,9 @@ CSample::CSample(vector<double>& samples, int startS, int n, uint _sampleRate, u
 	sampleRate = _sampleRate;
 	frames.assign(samples.begin() + startS, samples.begin() + startS + n);
 	if (fft != nullptr){
-		computeFrequencies(*fft, frames.data(), frequencies, origFrequencies, frames.size());
+		computeFrequencies(*fft, frames.data(), frequencies, frames.size());
 	} else {
-		computeFrequencies(frames.data(), frequencies, origFrequencies, frames.size());
+		computeFrequencies(frames.data(), frequencies, frames.size());
 	}
 	isNull = false;
 	normalize();
@@ -128,6 +131,18 @@ CSample::CSample(vector<double>& samples, int startS, int n, uint _sampleRate, u
 	endSample = end;
 }
 
+CSample::CSample(vector<double>&& _frames, vector<SFrequencies>&& _frequencies, uint _sampleRate, uint _id, uint start, uint end, uint _birdId){
+	sampleRate = _sampleRate;
+	frames = std::move(_frames);
+	frequencies = std::move(_frequencies);
+	isNull = false;
+	normalize();
+	id = _id;
+	birdId = _birdId;
+	startSample = start;
+	endSample = end;
+}
+
 CSample::CSample(const CSample& b) : CSignal(b) {
 	isNull = b.isNull;
 	id = b.id;
@@ -135,7 +150,11 @@ CSample::CSample(const CSample& b) : CSignal(b) {
 	startSample = b.startSample;
 	endSample = b.endSample;
 	frequencies = b.frequencies;  // vector copy
+	prepared = b.prepared;
+	envelope = b.envelope;
 	origFrequencies = b.origFrequencies;  // vector copy
+	weights = b.weights;
+	weight = b.weight;
 }
 
 CSample::CSample(SFrequencies* freqs, uint freqcount, uint birdid, uint sampleid){
@@ -152,81 +171,95 @@ CSample::CSample(SFrequencies* freqs, uint freqcount, uint birdid, uint sampleid
 	endSample = 0;
 }
 
-void CSample::consume(CSample& other){
+const vector<OrigFrequencies>& CSample::getOrigFrequencies() const {
+	if (origFrequencies.empty() && frames.size() >= FFT_SIZE){
+		computeOrigFrequencies(frames.data(), origFrequencies, frames.size());
+	}
+	return origFrequencies;
+}
+
+void CSample::consume(const CSample& other){
+	if (isNull || other.isNull){
+		return;
+	}
+	if (weights.empty()){
+		weights.assign(frequencies.size(), 1);
+	}
 	size_t c = min(frequencies.size(), other.frequencies.size());
 	for (size_t i=0; i<c; i++){
-		frequencies[i].consume(other.frequencies[i]);
+		uint w = other.frameWeight(i);
+		frequencies[i].consume(other.frequencies[i], weights[i], w);
+		weights[i] += w;
+	}
+	weight += other.weight;
+	if (isPrepared()){
+		prepare();
+	}
+}
+
+void CSample::prepare(){
+	prepared.clear();
+	prepared.reserve(frequencies.size());
+	for (const SFrequencies& f : frequencies){
+		prepared.emplace_back(f);
+	}
+	envelope = CSampleEnvelope(frequencies);
+}
+
+double CSample::lowerBound(const CSample& other, double bound) const {
+	if (isNull || other.isNull){
+		return 1.1;
 	}
+	return envelope.lowerBound(other.envelope, bound);
 }
 
-int ilosc = 0;
-double CSample::differ(CSample& other){
+double CSample::differ(CSample& other, double bound){
 	if (isNull || other.isNull){
 		return 1.1;
 	}
 	size_t myFreqCount = frequencies.size();
 	size_t otherFreqCount = other.frequencies.size();
 	if (2 * myFreqCount < otherFreqCount || 2 * otherFreqCount < myFreqCount){
-		++ilosc;
-		return 1.2;
+		return LENGTH_MISMATCH;
 	}
 	size_t count = min(myFreqCount, otherFreqCount);
 	double dif = 0.0;
+	// Frame differences are >= 0, so once the partial mean reaches bound the
+	// full mean can't go below it
+	const double limit = bound*count;
+	if (other.isPrepared()){
+		if (!isPrepared()){
+			prepare();
+		}
+		for (size_t i=0; i<count; i++){
+			dif += prepared[i].differ(other.prepared[i]);
+			if (dif >= limit && dif/count >= bound){
+				return dif/count;
+			}
+		}
+		return dif/count;
+	}
 	for (size_t i=0; i<count; i++){
 		double tmp = frequencies[i].differ(other.frequencies[i]);
 		dif += tmp;
+		if (dif >= limit && dif/count >= bound){
+			return dif/count;
+		}
 	}
 	return dif/count;
 }
 
 void CSample::normalize(){
-	// return;
-	double maximum = -100000;
-	double avg = 0;
-	double minAvg = 100000;
-	double minimum = 100000;
-	size_t freqCount = frequencies.size();
-	for (size_t j=0; j<freqCount; j++){
-		double *freq = frequencies[j].freq;
-		avg = 0;
-		for (uint i=0; i<COUNT_FREQ; i++){
-			// freq[i] = sqrt(freq[i]);
-			freq[i] = log(freq[i]);
-			avg += freq[i];
-			if (freq[i] > maximum){
-				maximum = freq[i];
-			}
-			if (freq[i] < minimum){
-				minimum = freq[i];
-			}
-		}
-		if (avg < minAvg){
-			minAvg = avg;
-		}
+	static_assert(sizeof(SFrequencies) == COUNT_FREQ*sizeof(freq_t), "SFrequencies rows must be contiguous");
+	if (frequencies.empty()){
+		isNull = true;
+		return;
 	}
-	// minimum = -00.0f;
-	minAvg /= COUNT_FREQ;
-	// minimum = minAvg;
-	minimum = (minAvg+maximum)/2;
-	// minimum = (minAvg*2+maximum)/3;
-	// printf("Max: %f, min2: %f\n", maximum, minimum);
-	// printf("Max: %f, min: %f, avg: %f\n", maximum, minimum, minAvg);
-	double SNR = maximum - minimum;
+	double SNR = normalizeRows<COUNT_FREQ>(frequencies[0].freq, frequencies.size());
 	// Use AudioConfig singleton for configurable threshold
 	if (SNR < AudioConfig::getInstance().snrMin){
 		isNull = true;
 	}
-	for (size_t j=0; j<freqCount; j++){
-		double *freq = frequencies[j].freq;
-		for (uint i=0; i<COUNT_FREQ; i++){
-			// freq[i] = (freq[i]-minimum)/(maximum-minimum);
-			freq[i] = max(0.0, (freq[i] - minimum)/(maximum-minimum));
-			if (freq[i] > 1.0){
-				printf("BLAD\n");
-			}
-			// freq[i] = max(0.0, freq[i]-0.2);
-		}
-	}
 }
 
 void CSample::saveFrequenciesTxt(const string& filename){
@@ -307,79 +340,101 @@ CAudio::CAudio(const string& filename) : CSignal(filename){
 	frames.shrink_to_fit();
 }
 
-CFFT::CFFT(){
-	in = (double*)fftw_malloc(FFT_SIZE*sizeof(double));
-	out = (double*)fftw_malloc(FFT_SIZE*sizeof(double));
-	if (!in || !out) {
-		fprintf(stderr, "Error: Failed to allocate FFTW buffers\n");
-		exit(1);
-	}
-	// Use FFTW_ESTIMATE instead of incorrectly passing direction as flag
-	rplan = fftw_plan_r2r_1d(FFT_SIZE, in, out, FFTW_R2HC, FFTW_ESTIMATE);
-	if (!rplan) {
-		fprintf(stderr, "Error: Failed to create FFTW plan\n");
-		exit(1);
-	}
+CFFT::CFFT(FFTPrecision _precision) : precision(_precision), engine(CSpectralEngine::create(_precision)){
 }
 
 CFFT::~CFFT(){
-	fftw_free(in);
-	fftw_free(out);
 }
 
+void CFFT::setPrecision(FFTPrecision _precision){
+	if (precision != _precision){
+		precision = _precision;
+		engine = CSpectralEngine::create(precision);
+	}
+}
 
 void CFFT::compute(double * _in, SFrequencies& _out, OrigFrequencies& _oOut){
-	HanningWindow(_in, in, FFT_SIZE);
-	fftw_execute(rplan);
-	for (uint i=1; i<FFT_SIZE; ++i){
-		double re = out[i];
-		double im = out[FFT_SIZE-i];
-		double val = re*re + im*im;
-		if (i >= FIRST_FREQ && i < COUNT_FREQ+FIRST_FREQ){
-			_out.freq[i-FIRST_FREQ] = val;
-		}
-		_oOut.freq[i] = val;
-		_oOut.maxValue = max (val, _oOut.maxValue);
-		_oOut.minValue = min (val, _oOut.minValue);
-	}
-	_oOut.freq[0] = out[0]/FFT_SIZE;
+	engine->computeFrames(_in, 1, &_out, &_oOut);
 }
 
 void CFFT::compute(double * _in, SFrequencies& _out){
-	HanningWindow(_in, in, FFT_SIZE);
-	fftw_execute(rplan);
-	for (uint i=0; i<COUNT_FREQ; ++i){
-		double re = out[i+FIRST_FREQ];
-		double im = out[FFT_SIZE-FIRST_FREQ-i];
-		_out.freq[i] = re*re + im*im;
-	}
+	engine->computeFrames(_in, 1, &_out, NULL);
+}
+
+void CFFT::computeFrames(const double * _in, int count, SFrequencies* _out, OrigFrequencies* _oOut){
+	engine->computeFrames(_in, count, _out, _oOut);
 }
 
 void computeFrequencies(CFFT& fft, double * _in, std::vector<SFrequencies>& _out, std::vector<OrigFrequencies>& _oOut, int n){
 	int sfCount = (n-FFT_SIZE)/SEGMENT_FRAMES + 1;
 	_out.resize(sfCount);
 	_oOut.resize(sfCount);
-	for (int i=0; i<sfCount; ++i) {
-		fft.compute(_in+i*SEGMENT_FRAMES, _out[i], _oOut[i]);
-	}
+	fft.computeFrames(_in, sfCount, _out.data(), _oOut.data());
 }
 
 void computeFrequencies(CFFT& fft, double * _in, std::vector<SFrequencies>& _out, int n){
 	int sfCount = (n-FFT_SIZE)/SEGMENT_FRAMES + 1;
 	_out.resize(sfCount);
-	for (int i=0; i<sfCount; ++i) {
-		fft.compute(_in+i*SEGMENT_FRAMES, _out[i]);
+	fft.computeFrames(_in, sfCount, _out.data());
+}
+
+CStreamingSTFT::CStreamingSTFT(CFFT& _fft) : fft(&_fft), block(FFT_SIZE + (STFT_BATCH-1)*SEGMENT_FRAMES), filled(0), samples(0){
+}
+
+void CStreamingSTFT::push(const double * in, size_t n){
+	samples += n;
+	while (n > 0){
+		size_t take = min(n, block.size() - filled);
+		memcpy(block.data() + filled, in, take*sizeof(double));
+		filled += take;
+		in += take;
+		n -= take;
+		if (filled == block.size()){
+			compute(STFT_BATCH);
+		}
+	}
+}
+
+void CStreamingSTFT::flush(){
+	if (filled >= FFT_SIZE){
+		compute((filled-FFT_SIZE)/SEGMENT_FRAMES + 1);
 	}
 }
 
+void CStreamingSTFT::reset(){
+	filled = 0;
+	samples = 0;
+	frequencies.clear();
+}
+
+void CStreamingSTFT::compute(int count){
+	size_t first = frequencies.size();
+	frequencies.resize(first + count);
+	fft->computeFrames(block.data(), count, frequencies.data() + first);
+	// Keep the samples from the next frame's start on
+	size_t consumed = count*SEGMENT_FRAMES;
+	memmove(block.data(), block.data() + consumed, (filled - consumed)*sizeof(double));
+	filled -= consumed;
+}
+
+// Shared by the overloads without an explicit CFFT, one per thread
+static CFFT& defaultFFT(){
+	thread_local CFFT fft;
+	return fft;
+}
+
 void computeFrequencies(double * _in, std::vector<SFrequencies>& _out, std::vector<OrigFrequencies>& _oOut, int n){
-	CFFT fft;
-	computeFrequencies(fft, _in, _out, _oOut, n);
+	computeFrequencies(defaultFFT(), _in, _out, _oOut, n);
 }
 
 void computeFrequencies(double * _in, std::vector<SFrequencies>& _out, int n){
-	CFFT fft;
-	computeFrequencies(fft, _in, _out, n);
+	computeFrequencies(defaultFFT(), _in, _out, n);
+}
+
+void computeOrigFrequencies(const double * _in, std::vector<OrigFrequencies>& _oOut, int n){
+	int sfCount = (n-FFT_SIZE)/SEGMENT_FRAMES + 1;
+	_oOut.resize(sfCount);
+	defaultFFT().computeFrames(_in, sfCount, NULL, _oOut.data());
 }
 
 SFrequencies::SFrequencies(){
@@ -392,29 +447,77 @@ SFrequencies::SFrequencies(const SFrequencies& b){
 	memcpy(freq, b.freq, sizeof(*freq)*COUNT_FREQ);
 }
 
-void SFrequencies::consume(SFrequencies&){
-	// int ofc = freq_count++;
-	// for (int i=0; i<CFFT::sGetFFTsize()/2; i++){
-	// 	freq[i] = (freq[i]*ofc + other.freq[i])/freq_count;
-	// }
+void SFrequencies::consume(const SFrequencies& other, uint weight, uint otherWeight){
+	const double share = (double)otherWeight/(weight + otherWeight);
+	for (uint i=0; i<COUNT_FREQ; i++){
+		freq[i] += (freq_t)((other.freq[i] - freq[i])*share);
+	}
 }
 
 double SFrequencies::differ(const SFrequencies& other) const {
-	double dif = 0;
-	int count = 0;
+	return differBins<COUNT_FREQ>(freq, other.freq);
+}
+
+SPreparedFrequencies::SPreparedFrequencies(const SFrequencies& f){
+	for (uint i=0; i<COUNT_FREQ; i++){
+		plus1[i] = f.freq[i] + 1;
+		reciprocal[i] = 1/plus1[i];
+	}
+}
+
+double SPreparedFrequencies::differ(const SPreparedFrequencies& other) const {
+	return differBinsPrepared<COUNT_FREQ>(plus1, reciprocal, other.plus1, other.reciprocal);
+}
+
+static void startBand(SFrequencies& low, SFrequencies& high, const SFrequencies& f){
+	memcpy(low.freq, f.freq, sizeof(f.freq));
+	memcpy(high.freq, f.freq, sizeof(f.freq));
+}
+
+static void widen(SFrequencies& low, SFrequencies& high, const SFrequencies& f){
 	for (uint i=0; i<COUNT_FREQ; i++){
-		double a = min(freq[i], other.freq[i])+1;
-		double b = max(freq[i], other.freq[i])+1;
-		if (b > 1.0){
-			dif += b/a;
-			// dif += log10(b) - log10(a) + 1;
-			// printf("log(%g) - log(%g) = %g - %g\n", b, a, log10(b), log10(a));
-			count++;
+		low.freq[i] = min(low.freq[i], f.freq[i]);
+		high.freq[i] = max(high.freq[i], f.freq[i]);
+	}
+}
+
+CSampleEnvelope::CSampleEnvelope(const vector<SFrequencies>& frequencies) : frames(frequencies.size()){
+	if (frames == 0){
+		return;
+	}
+	startBand(whole.low, whole.high, frequencies[0]);
+	blocks.resize((frames + ENVELOPE_BLOCK - 1)/ENVELOPE_BLOCK);
+	for (size_t f=0; f<frames; f++){
+		SBand& block = blocks[f/ENVELOPE_BLOCK];
+		if (f % ENVELOPE_BLOCK == 0){
+			startBand(block.low, block.high, frequencies[f]);
 		}
-		// printf("%f / %f = %f (%f)\n", b, a, b/a, dif);
+		widen(block.low, block.high, frequencies[f]);
+		widen(whole.low, whole.high, frequencies[f]);
+	}
+}
+
+double CSampleEnvelope::lowerBound(const CSampleEnvelope& other, double bound) const {
+	if (empty() || other.empty()){
+		return 0;
+	}
+	// differ returns 1.2 for these without comparing frames
+	if (2 * frames < other.frames || 2 * other.frames < frames){
+		return 1.2;
+	}
+	// The bounds sum in another order than differ; keep them below it by more than the rounding
+	const double slack = 1 - 64*numeric_limits<freq_t>::epsilon();
+	double wholeGap = envelopeGap<COUNT_FREQ>(whole.low.freq, whole.high.freq, other.whole.low.freq, other.whole.high.freq)*slack;
+	if (wholeGap >= bound){
+		return wholeGap;
+	}
+	size_t count = min(frames, other.frames);
+	double sum = 0;
+	for (size_t b=0; b*ENVELOPE_BLOCK<count; b++){
+		size_t n = min((size_t)ENVELOPE_BLOCK, count - b*ENVELOPE_BLOCK);
+		sum += n*envelopeGap<COUNT_FREQ>(blocks[b].low.freq, blocks[b].high.freq, other.blocks[b].low.freq, other.blocks[b].high.freq);
 	}
-	// return dif/COUNT_FREQ-1;
-	return dif/count-1;
+	return max(wholeGap, sum/count*slack);
 }
 
 OrigFrequencies::OrigFrequencies(){
@@ -554,6 +657,7 @@ vector<std::unique_ptr<CSample>> readLearningFromFile(const char* filename){
 			}
 		}
 		learn.push_back(std::make_unique<CSample>(frequencies.release(), freqCount, birdId, id));
+		learn.back()->prepare();
 	}
 #ifdef __DEBUG__
 	printf("Finished reading\n");
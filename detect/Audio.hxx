@@ -23,7 +23,9 @@
 #include <fftw3.h>
 
 // Standard library includes (alphabetically ordered, no duplicates)
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <fstream>
@@ -40,13 +42,28 @@
 
 typedef unsigned int uint;
 
-const double PI = 3.1415926535f;
+constexpr double PI = 3.1415926535f;
 const double DOUBLE_BIG = 1e10;
 const uint FIRST_FREQ = 12;
 const uint LAST_FREQ = 64; //without it (last freq is FREQ[63]) :(
 const uint COUNT_FREQ = LAST_FREQ-FIRST_FREQ;
 const uint FFT_SIZE = 256;
 const uint SEGMENT_FRAMES = 100;
+const uint STFT_BATCH = 32; //frames transformed by one many-transform plan
+
+// Precision of stored features. Building with BSC_SINGLE_PRECISION halves the
+// memory of SFrequencies and doubles the SIMD width of differ().
+#ifdef BSC_SINGLE_PRECISION
+typedef float freq_t;
+#else
+typedef double freq_t;
+#endif
+
+// Precision in which CFFT computes the transform
+enum FFTPrecision {
+	FFT_DOUBLE,
+	FFT_FLOAT
+};
 
 // Configuration parameters for audio processing
 // Use singleton pattern to provide global access while encapsulating state
@@ -80,88 +97,151 @@ uint birdIdFromName(const std::string& name);
 template <class T>
 T minim(const T& a, const T& b);
 
+// Window functions computing their coefficients on every call. They keep no
+// state, so they are safe to call from any thread; the FFT engines use the
+// precomputed HANNING_WINDOW table instead.
 template <class T>
-void HanningWindow(T* in, T* out, int n){
-	// Prevent buffer overflow - window size must not exceed maximum
-	assert(n > 0 && n <= 4096 && "Window size must be between 1 and 4096");
-
-	static std::array<T, 4096> tab;
-	static bool initialized = false;
-	static int cached_n = 0;
-
-	// Re-initialize if window size changes or first time
-	if (!initialized || cached_n != n) {
-		for (int j = 0; j < n; j++) {
-			tab[j] = static_cast<T>(0.50 - 0.50 * std::cos(2 * PI * j / n));
-		}
-		initialized = true;
-		cached_n = n;
+void HanningWindow(const T* in, T* out, int n){
+	assert(n > 0 && "Window size must be positive");
+	for (int j = 0; j < n; j++) {
+		out[j] = in[j] * static_cast<T>(0.50 - 0.50 * std::cos(2 * PI * j / n));
 	}
+}
 
-	// Apply pre-computed window
+template <class T>
+void HammingWindow(const T* in, T* out, int n){
+	assert(n > 0 && "Window size must be positive");
 	for (int j = 0; j < n; j++) {
-		out[j] = in[j] * tab[j];
+		out[j] = in[j] * static_cast<T>(0.54 - 0.46 * std::cos(2 * PI * j / n));
 	}
 }
 
 template <class T>
-void HammingWindow(T* in, T* out, int n){
-	// Prevent buffer overflow - window size must not exceed maximum
-	assert(n > 0 && n <= 4096 && "Window size must be between 1 and 4096");
-
-	static std::array<T, 4096> tab;
-	static bool initialized = false;
-	static int cached_n = 0;
-
-	// Re-initialize if window size changes or first time
-	if (!initialized || cached_n != n) {
-		for (int j = 0; j < n; j++) {
-			tab[j] = static_cast<T>(0.54 - 0.46 * std::cos(2 * PI * j / n));
-		}
-		initialized = true;
-		cached_n = n;
+void BlackmanWindow(const T* in, T* out, int n){
+	assert(n > 0 && "Window size must be positive");
+	int n_1 = n - 1;
+	for (int j = 0; j < n; j++) {
+		out[j] = in[j] * static_cast<T>(0.42 - 0.5 * std::cos(2 * PI * j / n_1) + 0.08 * std::cos(4 * PI * j / n_1));
 	}
+}
 
-	// Apply pre-computed window
-	for (int j = 0; j < n; j++) {
-		out[j] = in[j] * tab[j];
+// cos() usable in constant expressions (std::cos is not constexpr in C++17)
+constexpr double constexprCos(double x){
+	// Reduce with full precision pi; PI above is only float accurate
+	const double pi = 3.14159265358979323846;
+	while (x > pi){
+		x -= 2*pi;
 	}
+	while (x < -pi){
+		x += 2*pi;
+	}
+	double x2 = x*x;
+	double term = 1;
+	double sum = 1;
+	for (int k = 1; k < 30; k++){
+		term *= -x2/((2*k-1)*(2*k));
+		sum += term;
+	}
+	return sum;
 }
 
-template <class T>
-void BlackmanWindow(T* in, T* out, int n){
-	// Prevent buffer overflow - window size must not exceed maximum
-	assert(n > 0 && n <= 4096 && "Window size must be between 1 and 4096");
-
-	static std::array<T, 4096> tab;
-	static bool initialized = false;
-	static int cached_n = 0;
-
-	// Re-initialize if window size changes or first time
-	if (!initialized || cached_n != n) {
-		int n_1 = n - 1;
-		for (int j = 0; j < n; j++) {
-			tab[j] = static_cast<T>(0.42 - 0.5 * std::cos(2 * PI * j / n_1) + 0.08 * std::cos(4 * PI * j / n_1));
+// Hanning window of size N computed at compile time
+template <uint N>
+struct SHanningTable {
+	double w[N];
+	constexpr SHanningTable() : w() {
+		for (uint j = 0; j < N; j++) {
+			w[j] = 0.50 - 0.50 * constexprCos(2 * PI * j / N);
 		}
-		initialized = true;
-		cached_n = n;
 	}
-
-	// Apply pre-computed window
-	for (int j = 0; j < n; j++) {
-		out[j] = in[j] * tab[j];
+	constexpr double operator[](uint j) const {
+		return w[j];
 	}
-}
+};
+
+constexpr SHanningTable<FFT_SIZE> HANNING_WINDOW;
+
+const double LENGTH_MISMATCH = 1.2;	//CSample::differ of samples over twice as long as each other
 
 struct SFrequencies {
-	double freq[COUNT_FREQ];
+	freq_t freq[COUNT_FREQ];
 	~SFrequencies();
-	void consume(SFrequencies& other);
+	// Running mean: this frame averages weight frames, other otherWeight more
+	void consume(const SFrequencies& other, uint weight, uint otherWeight = 1);
 	double differ(const SFrequencies& other) const;
 	SFrequencies(const SFrequencies&);
 	SFrequencies();
 };
 
+// x+1 and 1/(x+1) of every bin of an SFrequencies. Between two prepared
+// frames the differ ratio is max(A/B, B/A) = max(A*(1/B), B*(1/A)), so it
+// needs no division.
+struct SPreparedFrequencies {
+	freq_t plus1[COUNT_FREQ];
+	freq_t reciprocal[COUNT_FREQ];
+	explicit SPreparedFrequencies(const SFrequencies& f);
+	double differ(const SPreparedFrequencies& other) const;
+};
+
+const uint ENVELOPE_BLOCK = 8;	//frames summarized by one CSampleEnvelope block
+
+// Per-bin minimum and maximum of a sample's frames, over the whole sample and
+// over blocks of ENVELOPE_BLOCK frames. Frames i of two samples are compared
+// with each other and lie in the same block, so the gap between two block
+// envelopes bounds the difference of every frame pair in that block.
+class CSampleEnvelope {
+	public:
+		CSampleEnvelope() : frames(0) {}
+		explicit CSampleEnvelope(const std::vector<SFrequencies>& frequencies);
+		bool empty() const {
+			return frames == 0;
+		}
+		// Lower bound on CSample::differ between the two summarized samples
+		// (0 if either is empty). Block envelopes are only visited while the
+		// whole-sample bound is below bound.
+		double lowerBound(const CSampleEnvelope& other, double bound = HUGE_VAL) const;
+	private:
+		struct SBand {
+			SFrequencies low;
+			SFrequencies high;
+		};
+		size_t frames;
+		SBand whole;
+		std::vector<SBand> blocks;
+};
+
+// How many nearest-neighbour candidates were skipped on their lower bound, or
+// without being looked at because their frame count is out of range
+struct SPruningStats {
+	private:
+		SPruningStats() : candidates(0), pruned(0), lengthSkipped(0) {}
+
+	public:
+		std::atomic<unsigned long long> candidates;
+		std::atomic<unsigned long long> pruned;
+		std::atomic<unsigned long long> lengthSkipped;
+
+		static SPruningStats& getInstance() {
+			static SPruningStats instance;
+			return instance;
+		}
+		void add(unsigned long long _candidates, unsigned long long _pruned, unsigned long long _lengthSkipped = 0){
+			candidates += _candidates;
+			pruned += _pruned;
+			lengthSkipped += _lengthSkipped;
+		}
+		void reset(){
+			candidates = 0;
+			pruned = 0;
+			lengthSkipped = 0;
+		}
+
+		SPruningStats(const SPruningStats&) = delete;
+		SPruningStats& operator=(const SPruningStats&) = delete;
+		SPruningStats(SPruningStats&&) = delete;
+		SPruningStats& operator=(SPruningStats&&) = delete;
+};
+
 struct OrigFrequencies {
 	double freq[FFT_SIZE];
 	~OrigFrequencies();
@@ -171,20 +251,58 @@ struct OrigFrequencies {
 	double maxValue;
 };
 
+class CSpectralEngine;
+
 class CFFT {
 	public:
-		CFFT();
+		explicit CFFT(FFTPrecision precision = FFT_DOUBLE);
 		~CFFT();
+		CFFT(const CFFT&) = delete;
+		CFFT& operator=(const CFFT&) = delete;
 		int getFFTsize() const{
 			return FFT_SIZE;
 		}
+		FFTPrecision getPrecision() const{
+			return precision;
+		}
+		void setPrecision(FFTPrecision precision);
 		void compute(double * in, SFrequencies& out);
 		void compute(double * _in, SFrequencies& _out, OrigFrequencies& _oOut);
+		// Batched STFT: frame i starts at _in + i*SEGMENT_FRAMES. Frames are windowed
+		// into one aligned matrix and transformed STFT_BATCH at a time with a single
+		// many-transform plan. Either _out or _oOut may be NULL when not needed.
+		void computeFrames(const double * _in, int count, SFrequencies* _out, OrigFrequencies* _oOut = nullptr);
 
 	private:
-		double * in;
-		double * out;
-		fftw_plan rplan;
+		FFTPrecision precision;
+		std::unique_ptr<CSpectralEngine> engine;
+};
+
+// Incremental STFT. Samples are pushed in blocks of any size; every frame that
+// becomes complete is computed, STFT_BATCH frames per transform, and appended
+// to getFrequencies(). Only the samples a pending frame still needs are kept.
+class CStreamingSTFT {
+	public:
+		explicit CStreamingSTFT(CFFT& fft);
+		void push(const double * in, size_t n);
+		// Computes the complete frames among the pending samples
+		void flush();
+		// Drops the pending samples and the computed frames
+		void reset();
+		std::vector<SFrequencies>& getFrequencies(){
+			return frequencies;
+		}
+		// Samples pushed since the last reset
+		size_t getSampleCount() const {
+			return samples;
+		}
+	private:
+		CFFT* fft;
+		std::vector<double> block;	//FFT_SIZE + (STFT_BATCH-1)*SEGMENT_FRAMES samples
+		size_t filled;
+		size_t samples;
+		std::vector<SFrequencies> frequencies;
+		void compute(int count);
 };
 
 class CSignal {
@@ -222,8 +340,33 @@ class CSignal {
 
 class CSample : public CSignal {
 	public:
-		void consume(CSample& other);
-		double differ(CSample& other);
+		// Merges other (a sample or another category) into this one, which becomes
+		// the mean of their members frame by frame. Frames are aligned from the
+		// start and the length stays that of this sample; frames past the end
+		// of other keep their mean.
+		void consume(const CSample& other);
+		// How many samples were merged into this one
+		uint getWeight() const {
+			return weight;
+		}
+		// Uses the prepared frames when other is prepared (preparing this sample if needed).
+		// Stops early, returning some value >= bound, once the result can't be below bound.
+		double differ(CSample& other, double bound = HUGE_VAL);
+		// Builds the prepared frames and the envelope; done once for learning
+		// samples, which are compared many times. Costs about 2.25 times the
+		// memory of the features.
+		void prepare();
+		// Cheap lower bound on differ(other); 0 unless both samples are prepared
+		double lowerBound(const CSample& other, double bound = HUGE_VAL) const;
+		bool isPrepared() const {
+			return !prepared.empty();
+		}
+		const std::vector<SPreparedFrequencies>& getPrepared() const {
+			return prepared;
+		}
+		const CSampleEnvelope& getEnvelope() const {
+			return envelope;
+		}
 		void saveFrequencies(const std::string& filename);
 		int saveFrequencies(std::ostream& out);
 		void saveFrequenciesTxt(const std::string& filename);
@@ -232,6 +375,8 @@ class CSample : public CSignal {
 		explicit CSample(SFrequencies*, uint freqcount, uint birdid, uint sampleid);
 		explicit CSample(double *, int n, uint sampleRate, uint id, uint start, uint end, uint bid, CFFT* fft = nullptr);
 		explicit CSample(std::vector<double>&, int startS, int n, uint sampleRate, uint id, uint start, uint end, uint bid, CFFT* fft = nullptr);
+		// Takes over frames and their not yet normalized band spectra (e.g. from CStreamingSTFT)
+		explicit CSample(std::vector<double>&& frames, std::vector<SFrequencies>&& frequencies, uint sampleRate, uint id, uint start, uint end, uint bid);
 		~CSample() = default;
 
 		uint getStartSampleNo() const {
@@ -249,9 +394,9 @@ class CSample : public CSignal {
 		uint getBirdId() const {
 			return birdId;
 		}
-		const std::vector<OrigFrequencies>& getOrigFrequencies() const {
-			return origFrequencies;
-		}
+		// Full spectrum, computed from the retained frames on first use (not thread safe).
+		// Empty for samples read from a learning file.
+		const std::vector<OrigFrequencies>& getOrigFrequencies() const;
 		const std::vector<SFrequencies>& getFrequencies() const {
 			return frequencies;
 		}
@@ -266,7 +411,14 @@ class CSample : public CSignal {
 	private:
 		bool isNull;
 		std::vector<SFrequencies> frequencies;
-		std::vector<OrigFrequencies> origFrequencies;
+		std::vector<SPreparedFrequencies> prepared;
+		CSampleEnvelope envelope;
+		mutable std::vector<OrigFrequencies> origFrequencies;
+		std::vector<uint> weights;	//samples averaged in each frame, empty while weight is 1
+		uint weight = 1;
+		uint frameWeight(size_t frame) const {
+			return weights.empty() ? 1 : weights[frame];
+		}
 		void normalize();
 		uint startSample;
 		uint endSample;
@@ -294,6 +446,7 @@ void computeFrequencies(CFFT& fft, double * _in, std::vector<SFrequencies>& _out
 void computeFrequencies(CFFT& fft, double * _in, std::vector<SFrequencies>& _out, std::vector<OrigFrequencies>& _oOut, int n);
 void computeFrequencies(double * _in, std::vector<SFrequencies>& _out, int n);
 void computeFrequencies(double * _in, std::vector<SFrequencies>& _out, std::vector<OrigFrequencies>& _oOut, int n);
+void computeOrigFrequencies(const double * _in, std::vector<OrigFrequencies>& _oOut, int n);
 void saveSamples(std::vector<CSample*>& samples, std::string dir, bool frequencies);
 
 inline double computePower(double frames[], int framesCount){
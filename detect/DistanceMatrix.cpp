@@ -0,0 +1,193 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "DistanceMatrix.hxx"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const size_t ROWS_PER_TASK = 32;
+
+// File layout: header, then the upper triangle as float in native byte order
+static const uint32_t DISTANCE_FILE_VERSION = 1;	//bump when differ changes
+struct SDistanceFileHeader {
+	char magic[4];	//"BSCD"
+	uint32_t version;
+	uint64_t key;
+	uint64_t count;	//samples
+};
+
+CDistanceMatrix::CDistanceMatrix(const vector<CSample*>& samples, CThreadPool* pool) : n(samples.size()), key(hash(samples)), mapping(nullptr), mappingBytes(0){
+	owned.resize(n*(n - min<size_t>(n, 1))/2);
+	values = owned.data();
+	for (CSample* s : samples){
+		if (!s->isPrepared()){
+			s->prepare();
+		}
+	}
+	auto row = [&](size_t i){
+		float* out = owned.data() + index(i, i+1);
+		for (size_t j=i+1; j<n; j++){
+			*out++ = samples[i]->differ(*samples[j]);
+		}
+	};
+	// Rows i and n-1-i together have n-1 pairs, so every task gets the same work
+	auto rows = [&](size_t from, size_t to){
+		for (size_t i=from; i<to; i++){
+			row(i);
+			if (n-1-i != i){
+				row(n-1-i);
+			}
+		}
+	};
+	const size_t half = (n + 1)/2;
+	vector<future<void>> tasks;
+	for (size_t from=0; from<half; from+=ROWS_PER_TASK){
+		size_t to = min(from + ROWS_PER_TASK, half);
+		if (pool != nullptr){
+			tasks.push_back(pool->submit([&rows, from, to](){
+				rows(from, to);
+			}));
+		} else {
+			rows(from, to);
+		}
+	}
+	for (future<void>& task : tasks){
+		task.get();
+	}
+}
+
+CDistanceMatrix::~CDistanceMatrix(){
+#ifndef _WIN32
+	if (mapping != nullptr){
+		munmap(mapping, mappingBytes);
+	}
+#endif
+}
+
+uint64_t CDistanceMatrix::hash(const vector<CSample*>& samples){
+	uint64_t h = 14695981039346656037ULL;
+	// 64-bit words rather than bytes: the frames of a learning set are
+	// hundreds of MB and the key is computed on every run
+	auto add = [&h](uint64_t word){
+		h ^= word;
+		h *= 1099511628211ULL;
+	};
+	const uint64_t parameters[] = {DISTANCE_FILE_VERSION, FFT_SIZE, SEGMENT_FRAMES, FIRST_FREQ, LAST_FREQ, sizeof(freq_t), samples.size()};
+	for (uint64_t p : parameters){
+		add(p);
+	}
+	for (const CSample* s : samples){
+		add(s->IsNull());
+		add(s->getFreqCount());
+		const vector<SFrequencies>& frequencies = s->getFrequencies();
+		for (const SFrequencies& f : frequencies){
+			const char* bytes = reinterpret_cast<const char*>(f.freq);
+			for (size_t i=0; i+sizeof(uint64_t)<=sizeof(f.freq); i+=sizeof(uint64_t)){
+				uint64_t word;
+				memcpy(&word, bytes + i, sizeof(word));
+				add(word);
+			}
+		}
+	}
+	return h;
+}
+
+bool CDistanceMatrix::save(const char* filename) const {
+	// Written aside and renamed, so a reader never maps a partial file
+	string tmp = string(filename) + ".tmp";
+	FILE* file = fopen(tmp.c_str(), "wb");
+	if (file == NULL){
+		fprintf(stderr, "Unable to create file: %s\n", tmp.c_str());
+		return false;
+	}
+	SDistanceFileHeader header = {{'B', 'S', 'C', 'D'}, DISTANCE_FILE_VERSION, key, n};
+	size_t count = n*(n - min<size_t>(n, 1))/2;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(values, sizeof(float), count, file) == count;
+	ok = fclose(file) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), filename) != 0){
+		fprintf(stderr, "Unable to save distances to %s\n", filename);
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+unique_ptr<CDistanceMatrix> CDistanceMatrix::load(const char* filename, uint64_t key, size_t n){
+	const size_t count = n*(n - min<size_t>(n, 1))/2;
+	const size_t bytes = sizeof(SDistanceFileHeader) + count*sizeof(float);
+	unique_ptr<CDistanceMatrix> matrix(new CDistanceMatrix());
+	matrix->n = n;
+	matrix->key = key;
+#ifndef _WIN32
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0){
+		return nullptr;
+	}
+	struct stat st;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size == bytes){
+		mapping = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (mapping == MAP_FAILED){
+		return nullptr;
+	}
+	matrix->mapping = mapping;
+	matrix->mappingBytes = bytes;
+	const SDistanceFileHeader* header = static_cast<const SDistanceFileHeader*>(mapping);
+	matrix->values = reinterpret_cast<const float*>(header + 1);
+#else
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL){
+		return nullptr;
+	}
+	SDistanceFileHeader stored;
+	const SDistanceFileHeader* header = &stored;
+	matrix->owned.resize(count);
+	bool ok = fread(&stored, sizeof(stored), 1, file) == 1 && fread(matrix->owned.data(), sizeof(float), count, file) == count;
+	fclose(file);
+	if (!ok){
+		return nullptr;
+	}
+	matrix->values = matrix->owned.data();
+#endif
+	if (memcmp(header->magic, "BSCD", 4) != 0 || header->version != DISTANCE_FILE_VERSION || header->key != key || header->count != n){
+		return nullptr;
+	}
+	return matrix;
+}
+
+unique_ptr<CDistanceMatrix> CDistanceMatrix::cached(const vector<CSample*>& samples, const char* cacheFile, CThreadPool* pool){
+	unique_ptr<CDistanceMatrix> matrix = load(cacheFile, hash(samples), samples.size());
+	if (!matrix){
+		matrix = make_unique<CDistanceMatrix>(samples, pool);
+		matrix->save(cacheFile);
+	}
+	return matrix;
+}
@@ -0,0 +1,74 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _DISTANCEMATRIX_HXX
+#define _DISTANCEMATRIX_HXX
+#include "Audio.hxx"
+#include "ThreadPool.hxx"
+#include <cstdint>
+
+// CSample::differ of every pair of a sample set, computed once. differ is
+// symmetric between prepared samples, so only the upper triangle is kept,
+// as float (half the memory of double; 800 MB for 20000 samples).
+//
+// A matrix can be saved and memory-mapped back later. The file is versioned
+// and keyed by a hash of the features and feature parameters of the
+// samples, so a changed learning set or snrMin is never served stale values.
+class CDistanceMatrix {
+	public:
+		CDistanceMatrix() : n(0), key(0), values(nullptr), mapping(nullptr), mappingBytes(0) {}
+		// Prepares the samples. Rows are computed on pool when given.
+		explicit CDistanceMatrix(const std::vector<CSample*>& samples, CThreadPool* pool = nullptr);
+		~CDistanceMatrix();
+		CDistanceMatrix(const CDistanceMatrix&) = delete;
+		CDistanceMatrix& operator=(const CDistanceMatrix&) = delete;
+
+		// The matrix of samples mapped from cacheFile when it was saved for
+		// the same key, otherwise computed and saved to cacheFile
+		static std::unique_ptr<CDistanceMatrix> cached(const std::vector<CSample*>& samples, const char* cacheFile, CThreadPool* pool = nullptr);
+		// nullptr unless filename holds a matrix of n samples saved for key
+		static std::unique_ptr<CDistanceMatrix> load(const char* filename, uint64_t key, size_t n);
+		bool save(const char* filename) const;
+		// FNV-1a of the feature parameters and of every sample's frames
+		static uint64_t hash(const std::vector<CSample*>& samples);
+
+		size_t size() const {
+			return n;
+		}
+		bool isMapped() const {
+			return mapping != nullptr;
+		}
+		float operator()(size_t i, size_t j) const {
+			if (i == j){
+				return 0;
+			}
+			return i < j ? values[index(i, j)] : values[index(j, i)];
+		}
+	private:
+		size_t n;
+		uint64_t key;
+		const float* values;	//(i, j) for i < j, row after row; in owned or mapping
+		std::vector<float> owned;
+		void* mapping;
+		size_t mappingBytes;
+		size_t index(size_t i, size_t j) const {
+			return i*(2*n - i - 1)/2 + (j - i - 1);
+		}
+};
+#endif
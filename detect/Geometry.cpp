@@ -0,0 +1,285 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Geometry.hxx"
+#include "Spectral.hxx"
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+template <class G, class T>
+TFeatureExtractor<G, T>::TFeatureExtractor(){
+	static constexpr SHanningTable<G::fftSize> hanning;
+	for (uint j=0; j<G::fftSize; j++){
+		window[j] = static_cast<T>(hanning[j]);
+	}
+	batchIn = SFFTW<T>::alloc(STFT_BATCH*G::fftSize);
+	batchOut = SFFTW<T>::alloc(STFT_BATCH*G::fftSize);
+	if (!batchIn || !batchOut) {
+		fprintf(stderr, "Error: Failed to allocate FFTW buffers\n");
+		exit(1);
+	}
+}
+
+template <class G, class T>
+TFeatureExtractor<G, T>::~TFeatureExtractor(){
+	SFFTW<T>::free(batchIn);
+	SFFTW<T>::free(batchOut);
+}
+
+template <class G, class T>
+void TFeatureExtractor<G, T>::computeFrames(const double* in, int count, freq_t* out, OrigFrequencies* oOut){
+	for (int first=0; first<count; first+=STFT_BATCH){
+		int rows = min((int)STFT_BATCH, count-first);
+		for (int r=0; r<rows; ++r){
+			const double* frame = in + (first+r)*G::hop;
+			T* row = batchIn + r*G::fftSize;
+			for (uint j=0; j<G::fftSize; ++j){
+				row[j] = static_cast<T>(frame[j]) * window[j];
+			}
+		}
+		SFFTW<T>::execute(CFFTPlanCache::getInstance().getPlan<T>(G::fftSize, rows), batchIn, batchOut);
+		for (int r=0; r<rows; ++r){
+			const T* spectrum = batchOut + r*G::fftSize;
+			if (out != NULL){
+				freq_t* sf = out + (size_t)(first+r)*G::countFreq;
+				for (uint i=0; i<G::countFreq; ++i){
+					T re = spectrum[i+G::firstFreq];
+					T im = spectrum[G::fftSize-G::firstFreq-i];
+					sf[i] = re*re + im*im;
+				}
+			}
+			if (oOut == NULL){
+				continue;
+			}
+			OrigFrequencies& of = oOut[first+r];
+			of.minValue = DOUBLE_BIG;
+			of.maxValue = -DOUBLE_BIG;
+			for (uint i=1; i<G::fftSize; ++i){
+				double re = spectrum[i];
+				double im = spectrum[G::fftSize-i];
+				double val = re*re + im*im;
+				of.freq[i] = val;
+				of.maxValue = max (val, of.maxValue);
+				of.minValue = min (val, of.minValue);
+			}
+			of.freq[0] = spectrum[0]/G::fftSize;
+		}
+	}
+}
+
+template <class G, class T>
+double TFeatureExtractor<G, T>::extract(const double* in, int n, vector<freq_t>& out){
+	// Batch buffers are allocated once per thread, not per call
+	static thread_local TFeatureExtractor extractor;
+	const int count = frameCount(n);
+	out.resize((size_t)count*G::countFreq);
+	if (count == 0){
+		return 0;
+	}
+	extractor.computeFrames(in, count, out.data());
+	return normalizeRows<G::countFreq>(out.data(), count);
+}
+
+template class TFeatureExtractor<DefaultGeometry, double>;
+template class TFeatureExtractor<DefaultGeometry, float>;
+template class TFeatureExtractor<Geometry48k>;
+template class TFeatureExtractor<Geometry22k>;
+
+template <class G>
+static SGeometryInfo makeGeometryInfo(const char* name, uint sampleRate){
+	SGeometryInfo info = {name, sampleRate, G::fftSize, G::hop, G::firstFreq, G::lastFreq, G::countFreq,
+		&TFeatureExtractor<G>::extract, &differRows<G::countFreq>};
+	return info;
+}
+
+const vector<SGeometryInfo>& featureGeometries(){
+	static const vector<SGeometryInfo> geometries = {
+		makeGeometryInfo<DefaultGeometry>("44k", 44100),
+		makeGeometryInfo<Geometry48k>("48k", 48000),
+		makeGeometryInfo<Geometry22k>("22k", 22050),
+	};
+	return geometries;
+}
+
+const SGeometryInfo& defaultGeometry(){
+	return featureGeometries()[0];
+}
+
+const SGeometryInfo* findGeometry(uint fftSize, uint firstFreq, uint lastFreq){
+	for (const SGeometryInfo& g : featureGeometries()){
+		if (g.fftSize == fftSize && g.firstFreq == firstFreq && g.lastFreq == lastFreq){
+			return &g;
+		}
+	}
+	return NULL;
+}
+
+const SGeometryInfo* findGeometry(const string& name){
+	for (const SGeometryInfo& g : featureGeometries()){
+		if (name == g.name){
+			return &g;
+		}
+	}
+	return NULL;
+}
+
+const SGeometryInfo* readLearningGeometry(const char* filename){
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL){
+		return NULL;
+	}
+	uint header[3];
+	size_t read = fread(header, sizeof(uint), 3, file);
+	fclose(file);
+	if (read != 3){
+		return NULL;
+	}
+	return findGeometry(header[0], header[1], header[2]);
+}
+
+CFeatureModel::CFeatureModel(const SGeometryInfo& _geometry) : geometry(_geometry){
+}
+
+bool CFeatureModel::addSignal(const double* in, int n, uint birdId, uint id){
+	SModelSample sample;
+	double SNR = geometry.extract(in, n, sample.features);
+	sample.frames = sample.features.size()/geometry.countFreq;
+	if (sample.frames == 0 || SNR < AudioConfig::getInstance().snrMin){
+		return false;
+	}
+	sample.birdId = birdId;
+	sample.id = id;
+	samples.push_back(std::move(sample));
+	return true;
+}
+
+void CFeatureModel::addSamples(const vector<CSample*>& _samples){
+	for (CSample* s : _samples){
+		const vector<double>& frames = s->getFrames();
+		addSignal(frames.data(), frames.size(), s->getBirdId(), s->getId());
+	}
+}
+
+const SModelSample* CFeatureModel::classify(const double* in, int n, double cutoff, double* diff) const {
+	vector<freq_t> features;
+	double SNR = geometry.extract(in, n, features);
+	size_t frames = features.size()/geometry.countFreq;
+	const SModelSample* bestMatch = NULL;
+	double bestValue = cutoff;
+	if (frames > 0 && SNR >= AudioConfig::getInstance().snrMin){
+		unsigned long long lengthSkipped = 0;
+		for (const SModelSample& s : samples){
+			// Over twice as long or short differs by LENGTH_MISMATCH, too much
+			// unless the cutoff is above it
+			if ((2 * frames < s.frames || 2 * s.frames < frames) && bestValue <= LENGTH_MISMATCH){
+				lengthSkipped++;
+				continue;
+			}
+			double tmp = geometry.differ(features.data(), frames, s.features.data(), s.frames, bestValue);
+			if (tmp < bestValue){
+				bestValue = tmp;
+				bestMatch = &s;
+			}
+		}
+		SPruningStats::getInstance().add(samples.size() - lengthSkipped, 0, lengthSkipped);
+	}
+	if (diff != nullptr){
+		*diff = bestValue;
+	}
+	return bestMatch;
+}
+
+bool CFeatureModel::save(const char* filename) const {
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL){
+		fprintf(stderr, "Unable to create file: %s\n", filename);
+		return false;
+	}
+	uint header[4] = {geometry.fftSize, geometry.firstFreq, geometry.lastFreq, (uint)samples.size()};
+	bool ok = fwrite(header, sizeof(uint), 4, file) == 4;
+	vector<uint> freqs(geometry.countFreq);
+	for (size_t i=0; ok && i<samples.size(); i++){
+		const SModelSample& s = samples[i];
+		uint sampleHeader[3] = {(uint)s.frames, s.birdId, s.id};
+		ok = fwrite(sampleHeader, sizeof(uint), 3, file) == 3;
+		for (size_t f=0; ok && f<s.frames; f++){
+			const freq_t* row = s.features.data() + f*geometry.countFreq;
+			for (uint j=0; j<geometry.countFreq; j++){
+				freqs[j] = (uint)(row[j]*4294967295.0);
+			}
+			ok = fwrite(freqs.data(), sizeof(uint), geometry.countFreq, file) == geometry.countFreq;
+		}
+	}
+	fclose(file);
+	if (!ok){
+		fprintf(stderr, "Error writting to file: %s\n", filename);
+	}
+	return ok;
+}
+
+unique_ptr<CFeatureModel> CFeatureModel::load(const char* filename){
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL){
+		fprintf(stderr, "Unable to open file: %s for reading\n", filename);
+		return nullptr;
+	}
+	uint header[4];
+	if (fread(header, sizeof(uint), 4, file) != 4){
+		fprintf(stderr, "Error during reading file\n");
+		fclose(file);
+		return nullptr;
+	}
+	const SGeometryInfo* geometry = findGeometry(header[0], header[1], header[2]);
+	if (geometry == NULL){
+		fprintf(stderr, "Unknown feature geometry (FFT %u, bins %u-%u)\n", header[0], header[1], header[2]);
+		fclose(file);
+		return nullptr;
+	}
+	auto model = make_unique<CFeatureModel>(*geometry);
+	vector<uint> freqs(geometry->countFreq);
+	for (uint i=0; i<header[3]; i++){
+		uint sampleHeader[3];
+		if (fread(sampleHeader, sizeof(uint), 3, file) != 3){
+			fprintf(stderr, "Error during reading file\n");
+			break;
+		}
+		SModelSample s;
+		s.frames = sampleHeader[0];
+		s.birdId = sampleHeader[1];
+		s.id = sampleHeader[2];
+		s.features.resize(s.frames*geometry->countFreq);
+		bool ok = true;
+		for (size_t f=0; ok && f<s.frames; f++){
+			ok = fread(freqs.data(), sizeof(uint), geometry->countFreq, file) == geometry->countFreq;
+			freq_t* row = s.features.data() + f*geometry->countFreq;
+			for (uint j=0; ok && j<geometry->countFreq; j++){
+				row[j] = 1.0*freqs[j]/4294967295u;
+			}
+		}
+		if (!ok){
+			fprintf(stderr, "Error during reading file\n");
+			break;
+		}
+		model->samples.push_back(std::move(s));
+	}
+	fclose(file);
+	return model;
+}
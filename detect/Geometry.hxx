@@ -0,0 +1,324 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _GEOMETRY_HXX
+#define _GEOMETRY_HXX
+#include "Audio.hxx"
+#include "Simd.hxx"
+
+// Frame layout of the feature extractor: transform size N, hop between frames
+// and the [FIRST, LAST) band of bins kept. Kernels templated on it keep fixed
+// trip counts, so each instantiated geometry is fully specialized.
+template <uint N, uint HOP, uint FIRST, uint LAST>
+struct SFeatureGeometry {
+	static const uint fftSize = N;
+	static const uint hop = HOP;
+	static const uint firstFreq = FIRST;
+	static const uint lastFreq = LAST;
+	static const uint countFreq = LAST - FIRST;
+	static_assert(FIRST > 0 && FIRST < LAST && LAST <= N/2, "Band must lie inside the half spectrum");
+};
+
+// The geometry of SFrequencies and CSample, tuned for 44.1 kHz
+typedef SFeatureGeometry<FFT_SIZE, SEGMENT_FRAMES, FIRST_FREQ, LAST_FREQ> DefaultGeometry;
+// Same 2-11 kHz band and 2.3 ms hop at other sample rates
+typedef SFeatureGeometry<256, 109, 11, 59> Geometry48k;
+typedef SFeatureGeometry<128, 50, 12, 64> Geometry22k;
+
+// Log of one frame in place; returns the frame sum and raises maximum
+template <class V, uint COUNT>
+double logFrame(freq_t* freq, freq_t& maximum){
+	typedef SScalar<freq_t> S;
+	typename V::reg vsum = V::zero();
+	typename V::reg vmax = V::set1(maximum);
+	uint i = 0;
+	for (; i + V::width <= COUNT; i += V::width){
+		typename V::reg x = fastLog<V, freq_t>(V::load(freq + i));
+		V::store(freq + i, x);
+		vsum = V::add(vsum, x);
+		vmax = V::max(x, vmax);
+	}
+	double sum = V::hsum(vsum);
+	maximum = V::hmax(vmax);
+	for (; i < COUNT; i++){
+		freq[i] = fastLog<S, freq_t>(freq[i]);
+		sum += freq[i];
+		maximum = S::max(freq[i], maximum);
+	}
+	return sum;
+}
+
+// freq = clamp((freq - minimum)*scale, 0, 1); NaN maps to 0
+template <class V, uint COUNT>
+void scaleFrame(freq_t* freq, freq_t minimum, freq_t scale){
+	typedef SScalar<freq_t> S;
+	const typename V::reg vmin = V::set1(minimum);
+	const typename V::reg vscale = V::set1(scale);
+	const typename V::reg zero = V::zero();
+	const typename V::reg one = V::set1(1);
+	uint i = 0;
+	for (; i + V::width <= COUNT; i += V::width){
+		typename V::reg x = V::mul(V::sub(V::load(freq + i), vmin), vscale);
+		V::store(freq + i, V::min(V::max(x, zero), one));
+	}
+	for (; i < COUNT; i++){
+		freq[i] = S::min(S::max((freq[i] - minimum)*scale, 0), 1);
+	}
+}
+
+// Normalizes count contiguous rows of COUNT band powers in place: one pass
+// takes the log and gathers the maximum and the quietest row sum, the second
+// maps [minimum, maximum] onto [0, 1]. Returns the SNR (maximum - minimum).
+template <uint COUNT>
+double normalizeRows(freq_t* rows, size_t count){
+	typedef SVec<freq_t> V;
+	freq_t maximum = -100000;
+	double minAvg = 100000;
+	for (size_t j=0; j<count; j++){
+		double avg = logFrame<V, COUNT>(rows + j*COUNT, maximum);
+		if (avg < minAvg){
+			minAvg = avg;
+		}
+	}
+	minAvg /= COUNT;
+	double minimum = (minAvg+maximum)/2;
+	freq_t scale = 1.0/(maximum-minimum);
+	for (size_t j=0; j<count; j++){
+		scaleFrame<V, COUNT>(rows + j*COUNT, minimum, scale);
+	}
+	return maximum - minimum;
+}
+
+// Distance between two frames of COUNT band bins: the mean max/min ratio of
+// (bin+1) over the bins where either frame has energy, minus 1. Reference
+// version of differBins, kept for tests.
+template <uint COUNT>
+double differBinsScalar(const freq_t* x, const freq_t* y){
+	freq_t dif = 0;
+	int count = 0;
+	for (uint i=0; i<COUNT; i++){
+		freq_t a = std::min(x[i], y[i])+1;
+		freq_t b = std::max(x[i], y[i])+1;
+		if (b > 1.0){
+			dif += b/a;
+			count++;
+		}
+	}
+	return dif/count-1;
+}
+
+// differBinsScalar without branches: bins where both frames are 0 are masked
+// out of the ratio sum and the count, both kept in vector registers. Sums in a
+// different order, so results agree to rounding (not bit for bit).
+template <uint COUNT>
+double differBins(const freq_t* x, const freq_t* y){
+	typedef SVec<freq_t> V;
+	typedef SScalar<freq_t> S;
+	const typename V::reg one = V::set1(1);
+	typename V::reg vdif = V::zero();
+	typename V::reg vcount = V::zero();
+	uint i = 0;
+	for (; i + V::width <= COUNT; i += V::width){
+		typename V::reg a = V::load(x + i);
+		typename V::reg b = V::load(y + i);
+		typename V::reg lo = V::add(V::min(a, b), one);
+		typename V::reg hi = V::add(V::max(a, b), one);
+		typename V::mask used = V::cmpgt(hi, one);
+		vdif = V::add(vdif, V::onlyIf(used, V::div(hi, lo)));
+		vcount = V::add(vcount, V::onlyIf(used, one));
+	}
+	freq_t dif = V::hsum(vdif);
+	freq_t count = V::hsum(vcount);
+	for (; i < COUNT; i++){
+		freq_t lo = S::min(x[i], y[i])+1;
+		freq_t hi = S::max(x[i], y[i])+1;
+		bool used = hi > 1;
+		dif += S::onlyIf(used, hi/lo);
+		count += used;
+	}
+	return dif/count-1;
+}
+
+// differBins on prepared frames (xp = x+1, xr = 1/(x+1)): multiplies and a
+// max instead of min, max and a division. Within an ulp of differBins per bin.
+template <uint COUNT>
+double differBinsPrepared(const freq_t* xp, const freq_t* xr, const freq_t* yp, const freq_t* yr){
+	typedef SVec<freq_t> V;
+	typedef SScalar<freq_t> S;
+	const typename V::reg one = V::set1(1);
+	typename V::reg vdif = V::zero();
+	typename V::reg vcount = V::zero();
+	uint i = 0;
+	for (; i + V::width <= COUNT; i += V::width){
+		typename V::reg a = V::load(xp + i);
+		typename V::reg b = V::load(yp + i);
+		typename V::reg ratio = V::max(V::mul(a, V::load(yr + i)), V::mul(b, V::load(xr + i)));
+		typename V::mask used = V::cmpgt(V::max(a, b), one);
+		vdif = V::add(vdif, V::onlyIf(used, ratio));
+		vcount = V::add(vcount, V::onlyIf(used, one));
+	}
+	freq_t dif = V::hsum(vdif);
+	freq_t count = V::hsum(vcount);
+	for (; i < COUNT; i++){
+		freq_t ratio = S::max(xp[i]*yr[i], yp[i]*xr[i]);
+		bool used = S::max(xp[i], yp[i]) > 1;
+		dif += S::onlyIf(used, ratio);
+		count += used;
+	}
+	return dif/count-1;
+}
+
+// Lower bound on differBins(x, y) for any x in [xLow, xHigh], y in [yLow, yHigh]
+// (per bin). A bin ratio is at least (gap side + 1)/(near side + 1) when the
+// ranges don't overlap, otherwise 1; bins silent in both frames have ratio 1
+// in this sum and are left out of differBins' count, so dividing by COUNT
+// never overestimates.
+template <uint COUNT>
+double envelopeGap(const freq_t* xLow, const freq_t* xHigh, const freq_t* yLow, const freq_t* yHigh){
+	typedef SVec<freq_t> V;
+	typedef SScalar<freq_t> S;
+	const typename V::reg one = V::set1(1);
+	typename V::reg vsum = V::zero();
+	uint i = 0;
+	for (; i + V::width <= COUNT; i += V::width){
+		typename V::reg lo = V::max(V::load(xLow + i), V::load(yLow + i));
+		typename V::reg hi = V::min(V::load(xHigh + i), V::load(yHigh + i));
+		// lo > hi only when the ranges are disjoint; then lo/hi are the facing ends
+		typename V::reg ratio = V::div(V::add(lo, one), V::add(hi, one));
+		vsum = V::add(vsum, V::onlyIf(V::cmpgt(lo, hi), V::sub(ratio, one)));
+	}
+	freq_t sum = V::hsum(vsum);
+	for (; i < COUNT; i++){
+		freq_t lo = S::max(xLow[i], yLow[i]);
+		freq_t hi = S::min(xHigh[i], yHigh[i]);
+		sum += S::onlyIf(lo > hi, (lo+1)/(hi+1) - 1);
+	}
+	return sum/COUNT;
+}
+
+// CSample::differ over rows of COUNT bins: mean frame distance over the common
+// length, LENGTH_MISMATCH when one sample is more than twice as long as the
+// other. Stops early, returning some value >= bound, once the mean can't be
+// below bound.
+template <uint COUNT>
+double differRows(const freq_t* a, size_t na, const freq_t* b, size_t nb, double bound = HUGE_VAL){
+	if (2 * na < nb || 2 * nb < na){
+		return LENGTH_MISMATCH;
+	}
+	size_t count = std::min(na, nb);
+	double dif = 0.0;
+	const double limit = bound*count;
+	for (size_t i=0; i<count; i++){
+		dif += differBins<COUNT>(a + i*COUNT, b + i*COUNT);
+		if (dif >= limit && dif/count >= bound){
+			return dif/count;
+		}
+	}
+	return dif/count;
+}
+
+// Band features of geometry G, transformed in precision T. Frames are windowed
+// into one aligned matrix and transformed STFT_BATCH at a time with a single
+// many-transform plan taken from CFFTPlanCache. CSample's features come from
+// TFeatureExtractor<DefaultGeometry> (through CFFT), other geometries' from
+// extract.
+template <class G, class T = double>
+class TFeatureExtractor {
+	static_assert(G::fftSize <= FFT_SIZE, "OrigFrequencies holds at most FFT_SIZE bins");
+	public:
+		TFeatureExtractor();
+		~TFeatureExtractor();
+		TFeatureExtractor(const TFeatureExtractor&) = delete;
+		TFeatureExtractor& operator=(const TFeatureExtractor&) = delete;
+		static int frameCount(int n){
+			return n < (int)G::fftSize ? 0 : (n - (int)G::fftSize)/G::hop + 1;
+		}
+		// Band powers (not normalized) of count frames, frame i starting at
+		// in + i*G::hop, into count rows of G::countFreq bins of out and full
+		// spectra into oOut; either may be NULL
+		void computeFrames(const double* in, int count, freq_t* out, OrigFrequencies* oOut = NULL);
+		// Normalized features of every frame of in[0, n) into out, frameCount(n)
+		// rows of G::countFreq bins, on this thread's extractor. Returns the SNR
+		// of the normalization.
+		static double extract(const double* in, int n, std::vector<freq_t>& out);
+	private:
+		T* batchIn;
+		T* batchOut;
+		std::array<T, G::fftSize> window;
+};
+
+// Runtime description of an instantiated geometry, as selected by the
+// FFT_SIZE/FIRST_FREQ/LAST_FREQ header of a learning file
+struct SGeometryInfo {
+	const char* name;
+	uint sampleRate;
+	uint fftSize;
+	uint hop;
+	uint firstFreq;
+	uint lastFreq;
+	uint countFreq;
+	double (*extract)(const double* in, int n, std::vector<freq_t>& out);
+	double (*differ)(const freq_t* a, size_t na, const freq_t* b, size_t nb, double bound);
+};
+
+const std::vector<SGeometryInfo>& featureGeometries();
+const SGeometryInfo& defaultGeometry();
+const SGeometryInfo* findGeometry(uint fftSize, uint firstFreq, uint lastFreq);
+const SGeometryInfo* findGeometry(const std::string& name);
+// Geometry named by the header of a learning file, NULL if unreadable or unknown
+const SGeometryInfo* readLearningGeometry(const char* filename);
+
+struct SModelSample {
+	uint birdId;
+	uint id;
+	size_t frames;
+	std::vector<freq_t> features;	//frames rows of countFreq bins
+};
+
+// Learning set in any registered geometry. Samples computed by CSample always
+// use DefaultGeometry; the model recomputes features from audio in its own
+// geometry, so models for other sample rates need no rebuild.
+class CFeatureModel {
+	public:
+		explicit CFeatureModel(const SGeometryInfo& geometry);
+		const SGeometryInfo& getGeometry() const {
+			return geometry;
+		}
+		const std::vector<SModelSample>& getSamples() const {
+			return samples;
+		}
+		// Returns false (and adds nothing) when the signal is below the SNR threshold
+		bool addSignal(const double* in, int n, uint birdId, uint id);
+		// Adds the samples that still have their audio frames
+		void addSamples(const std::vector<CSample*>& samples);
+		// Nearest learning sample with difference below cutoff, NULL if none
+		const SModelSample* classify(const double* in, int n, double cutoff, double* diff = nullptr) const;
+		// Same format as saveSamplesToFile, with this model's geometry in the header
+		bool save(const char* filename) const;
+		static std::unique_ptr<CFeatureModel> load(const char* filename);
+	private:
+		const SGeometryInfo& geometry;
+		std::vector<SModelSample> samples;
+};
+
+extern template class TFeatureExtractor<DefaultGeometry, double>;
+extern template class TFeatureExtractor<DefaultGeometry, float>;
+extern template class TFeatureExtractor<Geometry48k>;
+extern template class TFeatureExtractor<Geometry22k>;
+#endif
@@ -0,0 +1,335 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "LearningMatrix.hxx"
+#include "Geometry.hxx"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <queue>
+
+using namespace std;
+
+CLearningMatrix::CLearningMatrix(const vector<CSample*>& samples){
+	add(samples);
+}
+
+void CLearningMatrix::add(CSample& sample){
+	add(vector<CSample*>(1, &sample));
+}
+
+void CLearningMatrix::append(CSample& sample){
+	const vector<SFrequencies>& frequencies = sample.getFrequencies();
+	offsets.push_back(data.size());
+	data.resize(data.size() + frequencies.size()*ROW_STRIDE, 0);
+	freq_t* row = data.data() + offsets.back();
+	for (const SFrequencies& f : frequencies){
+		SPreparedFrequencies prepared(f);
+		memcpy(row, prepared.plus1, sizeof(prepared.plus1));
+		memcpy(row + COUNT_FREQ, prepared.reciprocal, sizeof(prepared.reciprocal));
+		row += ROW_STRIDE;
+	}
+	lengths.push_back(frequencies.size());
+	birdIds.push_back(sample.getBirdId());
+	ids.push_back(sample.getId());
+	envelopes.emplace_back(frequencies);
+	samples.push_back(&sample);
+}
+
+void CLearningMatrix::add(const vector<CSample*>& _samples){
+	vector<CSample*> all = samples;
+	for (CSample* s : _samples){
+		if (!s->IsNull()){
+			all.push_back(s);
+		}
+	}
+	stable_sort(all.begin(), all.end(), [](const CSample* a, const CSample* b){
+		return a->getFreqCount() < b->getFreqCount();
+	});
+	size_t frames = 0;
+	for (const CSample* s : all){
+		frames += s->getFreqCount();
+	}
+	clear();
+	data.reserve(frames*ROW_STRIDE);
+	for (CSample* s : all){
+		append(*s);
+	}
+}
+
+void CLearningMatrix::clear(){
+	data.clear();
+	offsets.clear();
+	lengths.clear();
+	birdIds.clear();
+	ids.clear();
+	envelopes.clear();
+	samples.clear();
+}
+
+size_t CLearningMatrix::memoryBytes() const {
+	return data.capacity()*sizeof(freq_t) + offsets.size()*sizeof(size_t) + 3*size()*sizeof(uint)
+		+ envelopes.size()*sizeof(CSampleEnvelope) + samples.size()*sizeof(CSample*);
+}
+
+double CLearningMatrix::differ(CSample& tested, size_t i, double bound) const {
+	if (tested.IsNull()){
+		return 1.1;
+	}
+	size_t testedFrames = tested.getFreqCount();
+	size_t otherFrames = lengths[i];
+	if (2 * testedFrames < otherFrames || 2 * otherFrames < testedFrames){
+		return LENGTH_MISMATCH;
+	}
+	if (!tested.isPrepared()){
+		tested.prepare();
+	}
+	const vector<SPreparedFrequencies>& x = tested.getPrepared();
+	size_t count = min(testedFrames, otherFrames);
+	const freq_t* row = data.data() + offsets[i];
+	double dif = 0.0;
+	const double limit = bound*count;
+	for (size_t f=0; f<count; f++, row += ROW_STRIDE){
+		dif += differBinsPrepared<COUNT_FREQ>(x[f].plus1, x[f].reciprocal, row, row + COUNT_FREQ);
+		if (dif >= limit && dif/count >= bound){
+			return dif/count;
+		}
+	}
+	return dif/count;
+}
+
+void CLearningMatrix::compatibleRange(const CSample& tested, size_t& first, size_t& last) const {
+	// 2*length >= n and length <= 2*n
+	size_t n = tested.getFreqCount();
+	first = lower_bound(lengths.begin(), lengths.end(), (n+1)/2) - lengths.begin();
+	last = upper_bound(lengths.begin() + first, lengths.end(), 2*n) - lengths.begin();
+}
+
+void CLearningMatrix::scan(CSample& tested, size_t from, size_t to, int& bestMatch, double& bestValue, unsigned long long& pruned) const {
+	const CSampleEnvelope& envelope = tested.getEnvelope();
+	for (size_t i=from; i<to; i++){
+		if (envelope.lowerBound(envelopes[i], bestValue) >= bestValue){
+			++pruned;
+			continue;
+		}
+		double tmp = differ(tested, i, bestValue);
+		if (tmp < bestValue){
+			bestValue = tmp;
+			bestMatch = i;
+		}
+	}
+}
+
+// Only a cutoff above LENGTH_MISMATCH lets a sample outside [first, last) match
+static void matchSkipped(size_t first, size_t last, size_t size, int& bestMatch, double& bestValue){
+	if (bestValue > LENGTH_MISMATCH && last - first < size){
+		bestValue = LENGTH_MISMATCH;
+		bestMatch = first > 0 ? 0 : last;
+	}
+}
+
+int CLearningMatrix::nearest(CSample& tested, double cutoff, double* diff) const {
+	int bestMatch = -1;
+	double bestValue = cutoff;
+	if (!tested.IsNull()){
+		if (!tested.isPrepared()){
+			tested.prepare();
+		}
+		size_t first, last;
+		compatibleRange(tested, first, last);
+		unsigned long long pruned = 0;
+		scan(tested, first, last, bestMatch, bestValue, pruned);
+		SPruningStats::getInstance().add(size(), pruned, size() - (last - first));
+		matchSkipped(first, last, size(), bestMatch, bestValue);
+	}
+	if (diff != nullptr){
+		*diff = bestValue;
+	}
+	return bestMatch;
+}
+
+// Reference frames (freq_t) per tile: about the size of an L2 cache, so a
+// tile stays cached while every query of a block is compared with it
+static const size_t TILE_VALUES = 256*1024/sizeof(freq_t);
+static const size_t TILE_QUERIES = 16;
+
+vector<int> CLearningMatrix::nearest(const vector<CSample*>& tested, double cutoff, vector<double>* diffs, CThreadPool* pool) const {
+	vector<int> bestMatch(tested.size(), -1);
+	vector<double> bestValue(tested.size(), cutoff);
+	// First sample of every reference tile, then size()
+	vector<size_t> tiles(1, 0);
+	for (size_t i=1; i<size(); i++){
+		if (offsets[i] - offsets[tiles.back()] >= TILE_VALUES){
+			tiles.push_back(i);
+		}
+	}
+	tiles.push_back(size());
+	// Queries [q0, q1) against every tile in turn. Each query still sees the
+	// references in order, so the results are those of nearest(tested[q]).
+	auto block = [&](size_t q0, size_t q1){
+		vector<size_t> first(q1 - q0, 0);
+		vector<size_t> last(q1 - q0, 0);
+		unsigned long long candidates = 0;
+		unsigned long long pruned = 0;
+		unsigned long long skipped = 0;
+		for (size_t q=q0; q<q1; q++){
+			if (tested[q]->IsNull()){
+				continue;
+			}
+			if (!tested[q]->isPrepared()){
+				tested[q]->prepare();
+			}
+			compatibleRange(*tested[q], first[q-q0], last[q-q0]);
+			candidates += size();
+			skipped += size() - (last[q-q0] - first[q-q0]);
+		}
+		for (size_t t=0; t+1<tiles.size(); t++){
+			for (size_t q=q0; q<q1; q++){
+				size_t from = max(tiles[t], first[q-q0]);
+				size_t to = min(tiles[t+1], last[q-q0]);
+				if (from < to){
+					scan(*tested[q], from, to, bestMatch[q], bestValue[q], pruned);
+				}
+			}
+		}
+		for (size_t q=q0; q<q1; q++){
+			if (!tested[q]->IsNull()){
+				matchSkipped(first[q-q0], last[q-q0], size(), bestMatch[q], bestValue[q]);
+			}
+		}
+		SPruningStats::getInstance().add(candidates, pruned, skipped);
+	};
+	vector<future<void>> blocks;
+	for (size_t q0=0; q0<tested.size(); q0+=TILE_QUERIES){
+		size_t q1 = min(q0 + TILE_QUERIES, tested.size());
+		if (pool != nullptr){
+			blocks.push_back(pool->submit([&block, q0, q1](){
+				block(q0, q1);
+			}));
+		} else {
+			block(q0, q1);
+		}
+	}
+	for (future<void>& f : blocks){
+		f.get();
+	}
+	if (diffs != nullptr){
+		*diffs = bestValue;
+	}
+	return bestMatch;
+}
+
+static bool nearer(const SNeighbour& a, const SNeighbour& b){
+	return a.diff < b.diff;
+}
+
+vector<SNeighbour> CLearningMatrix::nearestK(CSample& tested, size_t k, double cutoff) const {
+	// Max-heap on diff: top() is the k-th best so far
+	priority_queue<SNeighbour, vector<SNeighbour>, decltype(&nearer)> best(&nearer);
+	auto bound = [&](){
+		return best.size() < k ? cutoff : best.top().diff;
+	};
+	auto offer = [&](uint i, double diff){
+		if (diff < bound()){
+			if (best.size() == k){
+				best.pop();
+			}
+			best.push(SNeighbour{i, diff});
+		}
+	};
+	if (k > 0 && !tested.IsNull()){
+		if (!tested.isPrepared()){
+			tested.prepare();
+		}
+		const CSampleEnvelope& envelope = tested.getEnvelope();
+		size_t first, last;
+		compatibleRange(tested, first, last);
+		unsigned long long pruned = 0;
+		for (size_t i=first; i<last; i++){
+			double b = bound();
+			if (envelope.lowerBound(envelopes[i], b) >= b){
+				++pruned;
+				continue;
+			}
+			offer(i, differ(tested, i, b));
+		}
+		SPruningStats::getInstance().add(size(), pruned, size() - (last - first));
+		// Skipped samples differ by LENGTH_MISMATCH, which only a bound above it lets in
+		for (size_t i=0; i<first && LENGTH_MISMATCH < bound(); i++){
+			offer(i, LENGTH_MISMATCH);
+		}
+		for (size_t i=last; i<size() && LENGTH_MISMATCH < bound(); i++){
+			offer(i, LENGTH_MISMATCH);
+		}
+	}
+	vector<SNeighbour> result;
+	result.reserve(best.size());
+	for (; !best.empty(); best.pop()){
+		result.push_back(best.top());
+	}
+	reverse(result.begin(), result.end());
+	return result;
+}
+
+vector<SNeighbour> CLearningMatrix::nearestPerSpecies(CSample& tested, double cutoff) const {
+	map<uint, SNeighbour> best;	//by bird id
+	auto bound = [&](uint birdId){
+		auto it = best.find(birdId);
+		return it == best.end() ? cutoff : it->second.diff;
+	};
+	auto offer = [&](uint i, double diff){
+		if (diff < bound(birdIds[i])){
+			best[birdIds[i]] = SNeighbour{i, diff};
+		}
+	};
+	if (!tested.IsNull()){
+		if (!tested.isPrepared()){
+			tested.prepare();
+		}
+		const CSampleEnvelope& envelope = tested.getEnvelope();
+		size_t first, last;
+		compatibleRange(tested, first, last);
+		unsigned long long pruned = 0;
+		for (size_t i=first; i<last; i++){
+			double b = bound(birdIds[i]);
+			if (envelope.lowerBound(envelopes[i], b) >= b){
+				++pruned;
+				continue;
+			}
+			offer(i, differ(tested, i, b));
+		}
+		SPruningStats::getInstance().add(size(), pruned, size() - (last - first));
+		// Skipped samples differ by LENGTH_MISMATCH, which only a cutoff above it lets in
+		if (LENGTH_MISMATCH < cutoff){
+			for (size_t i=0; i<first; i++){
+				offer(i, LENGTH_MISMATCH);
+			}
+			for (size_t i=last; i<size(); i++){
+				offer(i, LENGTH_MISMATCH);
+			}
+		}
+	}
+	vector<SNeighbour> result;
+	result.reserve(best.size());
+	for (const auto& species : best){
+		result.push_back(species.second);
+	}
+	stable_sort(result.begin(), result.end(), nearer);
+	return result;
+}
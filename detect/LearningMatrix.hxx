@@ -0,0 +1,102 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _LEARNINGMATRIX_HXX
+#define _LEARNINGMATRIX_HXX
+#include "Audio.hxx"
+#include "Simd.hxx"
+#include "ThreadPool.hxx"
+
+// A search result: sample index in a CLearningMatrix and its difference
+struct SNeighbour {
+	uint index;
+	double diff;
+};
+
+// The prepared frames (x+1 and 1/(x+1) per bin, see SPreparedFrequencies) of a
+// whole learning set packed in one cache line aligned buffer, sample after
+// sample, with a table of offsets, lengths and ids. A scan streams through it
+// linearly instead of following a pointer to every sample's own vectors.
+// Samples are kept ordered by frame count: CSample::differ rejects pairs whose
+// frame counts differ more than twice, so a search only visits the contiguous
+// range of compatible lengths.
+class CLearningMatrix {
+	public:
+		// freq_t per stored frame: plus1, reciprocal, padded to a cache line
+		static const uint ROW_STRIDE = (2*COUNT_FREQ*sizeof(freq_t) + CACHE_LINE - 1)/CACHE_LINE*CACHE_LINE/sizeof(freq_t);
+
+		CLearningMatrix() = default;
+		explicit CLearningMatrix(const std::vector<CSample*>& samples);
+		// Null samples are skipped. The sample is only referenced to be
+		// returned by getSample, its features are copied. Adding rebuilds
+		// the matrix in frame count order, so add whole sets at once.
+		void add(CSample& sample);
+		void add(const std::vector<CSample*>& samples);
+		void clear();
+		size_t size() const {
+			return samples.size();
+		}
+		size_t memoryBytes() const;
+		uint getFrameCount(size_t i) const {
+			return lengths[i];
+		}
+		uint getBirdId(size_t i) const {
+			return birdIds[i];
+		}
+		uint getId(size_t i) const {
+			return ids[i];
+		}
+		CSample* getSample(size_t i) const {
+			return samples[i];
+		}
+		// Frame f of sample i: COUNT_FREQ plus1 values, then COUNT_FREQ reciprocals
+		const freq_t* getFrame(size_t i, size_t f) const {
+			return data.data() + offsets[i] + f*ROW_STRIDE;
+		}
+		// tested.differ(*getSample(i), bound); prepares tested if needed
+		double differ(CSample& tested, size_t i, double bound = HUGE_VAL) const;
+		// Samples [first, last) have a frame count differ accepts for tested
+		void compatibleRange(const CSample& tested, size_t& first, size_t& last) const;
+		// Nearest sample with difference below cutoff, -1 if none. Candidates
+		// are pruned on their envelopes like in test(). Of equally distant
+		// samples the first in frame count order is returned.
+		int nearest(CSample& tested, double cutoff, double* diff = nullptr) const;
+		// nearest() of every tested sample, computed in tiles of queries x
+		// references so that a block of reference frames is reused from cache
+		// by many queries. Blocks of queries run on pool when given.
+		std::vector<int> nearest(const std::vector<CSample*>& tested, double cutoff, std::vector<double>* diffs = nullptr, CThreadPool* pool = nullptr) const;
+		// The k nearest samples with difference below cutoff, nearest first.
+		// Kept in a bounded heap; the k-th best so far prunes the scan.
+		std::vector<SNeighbour> nearestK(CSample& tested, size_t k, double cutoff = HUGE_VAL) const;
+		// The nearest sample of every species with difference below cutoff,
+		// nearest first
+		std::vector<SNeighbour> nearestPerSpecies(CSample& tested, double cutoff = HUGE_VAL) const;
+	private:
+		void append(CSample& sample);
+		// Best match of tested among samples [from, to), improving on bestValue
+		void scan(CSample& tested, size_t from, size_t to, int& bestMatch, double& bestValue, unsigned long long& pruned) const;
+		std::vector<freq_t, SAlignedAllocator<freq_t>> data;
+		std::vector<size_t> offsets;	//first freq_t of each sample in data
+		std::vector<uint> lengths;	//frames
+		std::vector<uint> birdIds;
+		std::vector<uint> ids;
+		std::vector<CSampleEnvelope> envelopes;
+		std::vector<CSample*> samples;
+};
+#endif
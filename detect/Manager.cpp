@@ -31,10 +31,8 @@ void CManager::resetQueue(){
 	currFile.reset();
 }
 
-CManager::CManager(CFFT& fftRef){
+CManager::CManager(CFFT& fftRef) : stft(fftRef){
 	currFile = nullptr;
-	buffer.resize(BUFSIZE);
-	fft = &fftRef;
 	lastId = 0;
 	filter = NULL;
 	hopeCount = 0;
@@ -50,48 +48,38 @@ CSample* CManager::readFile(){
 	const uint minSampleCount = 2000;
 	//const uint minSampleCount = FFT_SIZE;
 	const uint frontSamples = 300;
-	bool rollOver = false;
-	uint idx = 0;
+	double block[delta];
+	preroll.resize(frontSamples);
+	size_t seen = 0;
 	bool found = false;
 	do {
 		for (uint j=0; j<delta; j++){
 			if (!currFile->readPossible()){
 				return NULL;
 			}
-			buffer[idx+j] = currFile->read();
+			block[j] = currFile->read();
+			preroll[(seen+j) % frontSamples] = block[j];
 		}
-		if (computePower(buffer.data() + idx, delta) > powerCutoff) {
+		seen += delta;
+		if (computePower(block, delta) > powerCutoff) {
 			found = true;
 		}
-		idx += delta;
-		if (idx >= BUFSIZE-delta){
-			rollOver = true;
-			idx = 0;
-		}
 	} while (!found);
 
-	uint pos = 0;
-	if (idx < frontSamples){
-		if (rollOver){
-			for (int i=idx-1; i>=0; --i){
-				buffer[i+frontSamples-idx] = buffer[i];
-			}
-			for (uint i = 0; i<frontSamples-idx; ++i){
-				buffer[i] = buffer[BUFSIZE-frontSamples+idx + i];
-			}
-		}
-		else {
-			pos = idx;
-		}
-	} else {
-		for (pos = 0; pos<frontSamples; ++pos){
-			buffer[pos] = buffer[idx-frontSamples + pos];
-		}
+	// The sample starts with up to frontSamples samples read before the signal.
+	// It is moved into the CSample and its spectra are computed while reading.
+	vector<double> frames;
+	frames.reserve(1 << 16);
+	for (size_t i = seen - min(seen, (size_t)frontSamples); i < seen; ++i){
+		frames.push_back(preroll[i % frontSamples]);
 	}
+	stft.reset();
+	stft.push(frames.data(), frames.size());
 
 	//int count = min((int)BUFSIZE, currFile->framesLeft());
 	//printf("FramesLeft: %d\n", currFile->framesLeft());
 	int count = (int)BUFSIZE;
+	uint pos = frames.size();
 	uint toLowCount = 0;
 	long long startFileSample = currFile->sampleNumber();
 	for (; pos<count-delta; pos+=delta){
@@ -99,12 +87,14 @@ CSample* CManager::readFile(){
 			break;
 		}
 		for (uint j=0; j<delta; j++){
-			buffer[pos + j] = currFile->read();
+			block[j] = currFile->read();
 			if (filter != NULL){
-				buffer[pos+j] = (*filter)(buffer[pos+j]);
+				block[j] = (*filter)(block[j]);
 			}
 		}
-		if (computePower(buffer.data() + pos, delta) <= powerCutoff){
+		frames.insert(frames.end(), block, block + delta);
+		stft.push(block, delta);
+		if (computePower(block, delta) <= powerCutoff){
 			toLowCount += delta;
 			if (toLowCount > hopeCount){
 				break;
@@ -126,7 +116,14 @@ CSample* CManager::readFile(){
 		last++;
 	}
 	string name = fn.substr(last, min(fn.size()-last, (size_t)4));
-	CSample* sample = new CSample(buffer.data(), pos-toLowCount, currFile->getSampleRate(), ++lastId, startFileSample, endFileSample, birdIdFromName(name), fft);
+	// Drop the quiet tail and the frames reaching into it
+	uint n = pos - toLowCount;
+	frames.resize(n);
+	stft.flush();
+	vector<SFrequencies> frequencies = std::move(stft.getFrequencies());
+	frequencies.resize((n-FFT_SIZE)/SEGMENT_FRAMES + 1);
+	stft.reset();
+	CSample* sample = new CSample(std::move(frames), std::move(frequencies), currFile->getSampleRate(), ++lastId, startFileSample, endFileSample, birdIdFromName(name));
 	sample->setName(name);
 	return sample;
 }
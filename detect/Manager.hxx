@@ -27,7 +27,7 @@
 #include "Filter.hxx"
 
 
-static const uint BUFSIZE = 1097152;
+static const uint BUFSIZE = 1097152;	//longest sample, in frames
 
 class CManager {
 	public:
@@ -62,8 +62,8 @@ class CManager {
 		std::list<std::string> analyzedFiles;
 		std::unique_ptr<CFile> currFile;
 
-		std::vector<double> buffer;
-		CFFT* fft;
+		std::vector<double> preroll;	//ring of the samples before a sample starts
+		CStreamingSTFT stft;	//spectra of the sample being read, computed as it arrives
 		double powerCutoff;
 		uint hopeCount;
 		CFilter* filter;
@@ -0,0 +1,133 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Quantized.hxx"
+#include <array>
+
+using namespace std;
+
+// 1/(QMAX+q) for 8-bit values (1 KB); 16-bit values are divided directly
+static array<float, 256> makeReciprocals8(){
+	array<float, 256> table;
+	for (uint q=0; q<table.size(); q++){
+		table[q] = 1.0f/(SQuantization<uint8_t>::QMAX + q);
+	}
+	return table;
+}
+
+static const array<float, 256> RECIPROCALS8 = makeReciprocals8();
+
+template <class Q>
+double differQuantized(const Q* x, const Q* y){
+	const uint QMAX = SQuantization<Q>::QMAX;
+	float dif = 0;
+	int count = 0;
+	for (uint i=0; i<COUNT_FREQ; i++){
+		uint lo = min<uint>(x[i], y[i]);
+		uint hi = max<uint>(x[i], y[i]);
+		float ratio;
+		if constexpr (sizeof(Q) == 1){
+			ratio = (QMAX + hi) * RECIPROCALS8[lo];
+		} else {
+			ratio = (float)(QMAX + hi) / (float)(QMAX + lo);
+		}
+		bool used = hi != 0;
+		dif += used ? ratio : 0.0f;
+		count += used;
+	}
+	return dif/count - 1;
+}
+
+template double differQuantized<uint8_t>(const uint8_t*, const uint8_t*);
+template double differQuantized<uint16_t>(const uint16_t*, const uint16_t*);
+
+template <class Q>
+vector<Q> TQuantizedSet<Q>::quantize(const CSample& sample){
+	const vector<SFrequencies>& freqs = sample.getFrequencies();
+	vector<Q> out(freqs.size()*COUNT_FREQ);
+	for (size_t f=0; f<freqs.size(); f++){
+		for (uint i=0; i<COUNT_FREQ; i++){
+			out[f*COUNT_FREQ + i] = SQuantization<Q>::quantize(freqs[f].freq[i]);
+		}
+	}
+	return out;
+}
+
+template <class Q>
+void TQuantizedSet<Q>::add(const CSample& sample){
+	if (sample.IsNull()){
+		return;
+	}
+	vector<Q> q = quantize(sample);
+	offsets.push_back(data.size());
+	data.insert(data.end(), q.begin(), q.end());
+	frames.push_back(sample.getFreqCount());
+	birdIds.push_back(sample.getBirdId());
+	ids.push_back(sample.getId());
+}
+
+template <class Q>
+void TQuantizedSet<Q>::add(const vector<CSample*>& samples){
+	for (const CSample* s : samples){
+		add(*s);
+	}
+}
+
+template <class Q>
+size_t TQuantizedSet<Q>::memoryBytes() const {
+	return data.size()*sizeof(Q) + offsets.size()*sizeof(size_t) + 3*birdIds.size()*sizeof(uint);
+}
+
+template <class Q>
+double TQuantizedSet<Q>::differ(const vector<Q>& tested, size_t testedFrames, size_t i) const {
+	size_t otherFrames = frames[i];
+	if (2 * testedFrames < otherFrames || 2 * otherFrames < testedFrames){
+		return 1.2;
+	}
+	size_t count = min(testedFrames, otherFrames);
+	const Q* other = data.data() + offsets[i];
+	double dif = 0.0;
+	for (size_t f=0; f<count; f++){
+		dif += differQuantized<Q>(tested.data() + f*COUNT_FREQ, other + f*COUNT_FREQ);
+	}
+	return dif/count;
+}
+
+template <class Q>
+int TQuantizedSet<Q>::nearest(const CSample& tested, double cutoff, double* diff) const {
+	int bestMatch = -1;
+	double bestValue = cutoff;
+	if (!tested.IsNull()){
+		vector<Q> q = quantize(tested);
+		for (size_t i=0; i<size(); i++){
+			double tmp = differ(q, tested.getFreqCount(), i);
+			if (tmp < bestValue){
+				bestValue = tmp;
+				bestMatch = i;
+			}
+		}
+	}
+	if (diff != nullptr){
+		*diff = bestValue;
+	}
+	return bestMatch;
+}
+
+template class TQuantizedSet<uint8_t>;
+template class TQuantizedSet<uint16_t>;
@@ -0,0 +1,75 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _QUANTIZED_HXX
+#define _QUANTIZED_HXX
+#include "Audio.hxx"
+#include <cstdint>
+
+// Normalized features are in [0, 1]; Q stores round(x * QMAX) per bin.
+template <class Q>
+struct SQuantization {
+	static const uint QMAX = (uint)(Q)~(Q)0;
+	static Q quantize(freq_t x){
+		return (Q)(std::min(std::max(x, (freq_t)0), (freq_t)1)*QMAX + (freq_t)0.5);
+	}
+};
+
+// SFrequencies::differ on quantized frames. With x = q/QMAX the bin ratio
+// (max+1)/(min+1) becomes (QMAX+max)/(QMAX+min); the loop is branch free.
+// Bins that quantize to 0 in both frames are skipped, as exact zeros are
+// in differBins, so the result matches to within the quantization step.
+template <class Q>
+double differQuantized(const Q* x, const Q* y);
+
+// Learning set stored as quantized features in one contiguous array, 1 or 2
+// bytes per bin instead of sizeof(freq_t). Only the ids needed to report a
+// match are kept with it, so the CSamples can be released once it is built.
+template <class Q>
+class TQuantizedSet {
+	public:
+		// Null samples are skipped
+		void add(const CSample& sample);
+		void add(const std::vector<CSample*>& samples);
+		size_t size() const {
+			return birdIds.size();
+		}
+		size_t memoryBytes() const;
+		uint getBirdId(size_t i) const {
+			return birdIds[i];
+		}
+		uint getId(size_t i) const {
+			return ids[i];
+		}
+		// CSample::differ between tested (quantized on the fly) and sample i
+		double differ(const std::vector<Q>& tested, size_t testedFrames, size_t i) const;
+		// Nearest sample with difference below cutoff, -1 if none
+		int nearest(const CSample& tested, double cutoff, double* diff = nullptr) const;
+		static std::vector<Q> quantize(const CSample& sample);
+	private:
+		std::vector<Q> data;
+		std::vector<size_t> offsets;	//first bin of each sample in data
+		std::vector<uint> frames;
+		std::vector<uint> birdIds;
+		std::vector<uint> ids;
+};
+
+extern template class TQuantizedSet<uint8_t>;
+extern template class TQuantizedSet<uint16_t>;
+#endif
@@ -0,0 +1,331 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SIMD_HXX
+#define _SIMD_HXX
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#if !defined(BSC_NO_SIMD) && defined(__AVX2__)
+#define BSC_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(BSC_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#define BSC_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// Minimal portable vector layer for the feature kernels. SVec<T> wraps the
+// widest registers enabled at build time (AVX2, else SSE2), SScalar<T> is the
+// one-lane fallback used for loop tails and builds without SIMD
+// (-DBSC_NO_SIMD). Both expose the same static operations so kernels are
+// written once, as templates over the operation set V.
+
+template <class T>
+struct SScalar {
+	typedef T reg;
+	typedef bool mask;
+	static const int width = 1;
+	static reg load(const T* p){ return *p; }
+	static void store(T* p, reg v){ *p = v; }
+	static reg set1(T x){ return x; }
+	static reg zero(){ return 0; }
+	static reg add(reg a, reg b){ return a + b; }
+	static reg sub(reg a, reg b){ return a - b; }
+	static reg mul(reg a, reg b){ return a * b; }
+	static reg div(reg a, reg b){ return a / b; }
+	// min/max return b when a comparison is unordered, like minpd/maxpd
+	static reg min(reg a, reg b){ return a < b ? a : b; }
+	static reg max(reg a, reg b){ return a > b ? a : b; }
+	static mask cmpgt(reg a, reg b){ return a > b; }
+	static mask cmplt(reg a, reg b){ return a < b; }
+	static reg select(mask m, reg a, reg b){ return m ? a : b; }
+	static reg onlyIf(mask m, reg a){ return m ? a : 0; }
+	static bool any(mask m){ return m; }
+	static T hsum(reg v){ return v; }
+	static T hmax(reg v){ return v; }
+	static T hmin(reg v){ return v; }
+	// x = mantissa(x) * 2^exponent(x), mantissa in [1, 2), for normal x > 0
+	static reg exponent(reg x);
+	static reg mantissa(reg x);
+};
+
+template <>
+inline double SScalar<double>::exponent(double x){
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return (double)(int)((bits >> 52) & 0x7ff) - 1023;
+}
+
+template <>
+inline double SScalar<double>::mantissa(double x){
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+	memcpy(&x, &bits, sizeof(bits));
+	return x;
+}
+
+template <>
+inline float SScalar<float>::exponent(float x){
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return (float)(int)((bits >> 23) & 0xff) - 127;
+}
+
+template <>
+inline float SScalar<float>::mantissa(float x){
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	bits = (bits & 0x007fffffU) | 0x3f800000U;
+	memcpy(&x, &bits, sizeof(bits));
+	return x;
+}
+
+template <class T>
+struct SVec : SScalar<T> {
+};
+
+#if defined(BSC_SIMD_AVX2)
+template <>
+struct SVec<double> {
+	typedef __m256d reg;
+	typedef __m256d mask;
+	static const int width = 4;
+	static reg load(const double* p){ return _mm256_loadu_pd(p); }
+	static void store(double* p, reg v){ _mm256_storeu_pd(p, v); }
+	static reg set1(double x){ return _mm256_set1_pd(x); }
+	static reg zero(){ return _mm256_setzero_pd(); }
+	static reg add(reg a, reg b){ return _mm256_add_pd(a, b); }
+	static reg sub(reg a, reg b){ return _mm256_sub_pd(a, b); }
+	static reg mul(reg a, reg b){ return _mm256_mul_pd(a, b); }
+	static reg div(reg a, reg b){ return _mm256_div_pd(a, b); }
+	static reg min(reg a, reg b){ return _mm256_min_pd(a, b); }
+	static reg max(reg a, reg b){ return _mm256_max_pd(a, b); }
+	static mask cmpgt(reg a, reg b){ return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+	static mask cmplt(reg a, reg b){ return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+	static reg select(mask m, reg a, reg b){ return _mm256_blendv_pd(b, a, m); }
+	static reg onlyIf(mask m, reg a){ return _mm256_and_pd(m, a); }
+	static bool any(mask m){ return _mm256_movemask_pd(m) != 0; }
+	static double hsum(reg v){
+		__m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+	}
+	static double hmax(reg v){
+		__m128d s = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_max_sd(s, _mm_unpackhi_pd(s, s)));
+	}
+	static double hmin(reg v){
+		__m128d s = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_min_sd(s, _mm_unpackhi_pd(s, s)));
+	}
+	static reg exponent(reg x){
+		// Biased exponent ORed into the mantissa of 2^52 gives 2^52 + e exactly
+		__m256i e = _mm256_srli_epi64(_mm256_castpd_si256(x), 52);
+		e = _mm256_and_si256(e, _mm256_set1_epi64x(0x7ff));
+		reg biased = _mm256_castsi256_pd(_mm256_or_si256(e, _mm256_set1_epi64x(0x4330000000000000LL)));
+		return _mm256_sub_pd(biased, _mm256_set1_pd(4503599627370496.0 + 1023));
+	}
+	static reg mantissa(reg x){
+		__m256i bits = _mm256_and_si256(_mm256_castpd_si256(x), _mm256_set1_epi64x(0x000fffffffffffffLL));
+		return _mm256_castsi256_pd(_mm256_or_si256(bits, _mm256_set1_epi64x(0x3ff0000000000000LL)));
+	}
+};
+
+template <>
+struct SVec<float> {
+	typedef __m256 reg;
+	typedef __m256 mask;
+	static const int width = 8;
+	static reg load(const float* p){ return _mm256_loadu_ps(p); }
+	static void store(float* p, reg v){ _mm256_storeu_ps(p, v); }
+	static reg set1(float x){ return _mm256_set1_ps(x); }
+	static reg zero(){ return _mm256_setzero_ps(); }
+	static reg add(reg a, reg b){ return _mm256_add_ps(a, b); }
+	static reg sub(reg a, reg b){ return _mm256_sub_ps(a, b); }
+	static reg mul(reg a, reg b){ return _mm256_mul_ps(a, b); }
+	static reg div(reg a, reg b){ return _mm256_div_ps(a, b); }
+	static reg min(reg a, reg b){ return _mm256_min_ps(a, b); }
+	static reg max(reg a, reg b){ return _mm256_max_ps(a, b); }
+	static mask cmpgt(reg a, reg b){ return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static mask cmplt(reg a, reg b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static reg select(mask m, reg a, reg b){ return _mm256_blendv_ps(b, a, m); }
+	static reg onlyIf(mask m, reg a){ return _mm256_and_ps(m, a); }
+	static bool any(mask m){ return _mm256_movemask_ps(m) != 0; }
+	static float hsum(reg v){
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+	}
+	static float hmax(reg v){
+		__m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+		return _mm_cvtss_f32(_mm_max_ss(s, _mm_shuffle_ps(s, s, 1)));
+	}
+	static float hmin(reg v){
+		__m128 s = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_min_ps(s, _mm_movehl_ps(s, s));
+		return _mm_cvtss_f32(_mm_min_ss(s, _mm_shuffle_ps(s, s, 1)));
+	}
+	static reg exponent(reg x){
+		__m256i e = _mm256_and_si256(_mm256_srli_epi32(_mm256_castps_si256(x), 23), _mm256_set1_epi32(0xff));
+		return _mm256_sub_ps(_mm256_cvtepi32_ps(e), _mm256_set1_ps(127));
+	}
+	static reg mantissa(reg x){
+		__m256i bits = _mm256_and_si256(_mm256_castps_si256(x), _mm256_set1_epi32(0x007fffff));
+		return _mm256_castsi256_ps(_mm256_or_si256(bits, _mm256_set1_epi32(0x3f800000)));
+	}
+};
+#elif defined(BSC_SIMD_SSE2)
+template <>
+struct SVec<double> {
+	typedef __m128d reg;
+	typedef __m128d mask;
+	static const int width = 2;
+	static reg load(const double* p){ return _mm_loadu_pd(p); }
+	static void store(double* p, reg v){ _mm_storeu_pd(p, v); }
+	static reg set1(double x){ return _mm_set1_pd(x); }
+	static reg zero(){ return _mm_setzero_pd(); }
+	static reg add(reg a, reg b){ return _mm_add_pd(a, b); }
+	static reg sub(reg a, reg b){ return _mm_sub_pd(a, b); }
+	static reg mul(reg a, reg b){ return _mm_mul_pd(a, b); }
+	static reg div(reg a, reg b){ return _mm_div_pd(a, b); }
+	static reg min(reg a, reg b){ return _mm_min_pd(a, b); }
+	static reg max(reg a, reg b){ return _mm_max_pd(a, b); }
+	static mask cmpgt(reg a, reg b){ return _mm_cmpgt_pd(a, b); }
+	static mask cmplt(reg a, reg b){ return _mm_cmplt_pd(a, b); }
+	static reg select(mask m, reg a, reg b){ return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+	static reg onlyIf(mask m, reg a){ return _mm_and_pd(m, a); }
+	static bool any(mask m){ return _mm_movemask_pd(m) != 0; }
+	static double hsum(reg v){ return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+	static double hmax(reg v){ return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v))); }
+	static double hmin(reg v){ return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v))); }
+	static reg exponent(reg x){
+		// Biased exponent ORed into the mantissa of 2^52 gives 2^52 + e exactly
+		__m128i e = _mm_and_si128(_mm_srli_epi64(_mm_castpd_si128(x), 52), _mm_set1_epi64x(0x7ff));
+		reg biased = _mm_castsi128_pd(_mm_or_si128(e, _mm_set1_epi64x(0x4330000000000000LL)));
+		return _mm_sub_pd(biased, _mm_set1_pd(4503599627370496.0 + 1023));
+	}
+	static reg mantissa(reg x){
+		__m128i bits = _mm_and_si128(_mm_castpd_si128(x), _mm_set1_epi64x(0x000fffffffffffffLL));
+		return _mm_castsi128_pd(_mm_or_si128(bits, _mm_set1_epi64x(0x3ff0000000000000LL)));
+	}
+};
+
+template <>
+struct SVec<float> {
+	typedef __m128 reg;
+	typedef __m128 mask;
+	static const int width = 4;
+	static reg load(const float* p){ return _mm_loadu_ps(p); }
+	static void store(float* p, reg v){ _mm_storeu_ps(p, v); }
+	static reg set1(float x){ return _mm_set1_ps(x); }
+	static reg zero(){ return _mm_setzero_ps(); }
+	static reg add(reg a, reg b){ return _mm_add_ps(a, b); }
+	static reg sub(reg a, reg b){ return _mm_sub_ps(a, b); }
+	static reg mul(reg a, reg b){ return _mm_mul_ps(a, b); }
+	static reg div(reg a, reg b){ return _mm_div_ps(a, b); }
+	static reg min(reg a, reg b){ return _mm_min_ps(a, b); }
+	static reg max(reg a, reg b){ return _mm_max_ps(a, b); }
+	static mask cmpgt(reg a, reg b){ return _mm_cmpgt_ps(a, b); }
+	static mask cmplt(reg a, reg b){ return _mm_cmplt_ps(a, b); }
+	static reg select(mask m, reg a, reg b){ return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+	static reg onlyIf(mask m, reg a){ return _mm_and_ps(m, a); }
+	static bool any(mask m){ return _mm_movemask_ps(m) != 0; }
+	static float hsum(reg v){
+		v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_add_ss(v, _mm_shuffle_ps(v, v, 1)));
+	}
+	static float hmax(reg v){
+		v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_max_ss(v, _mm_shuffle_ps(v, v, 1)));
+	}
+	static float hmin(reg v){
+		v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_min_ss(v, _mm_shuffle_ps(v, v, 1)));
+	}
+	static reg exponent(reg x){
+		__m128i e = _mm_and_si128(_mm_srli_epi32(_mm_castps_si128(x), 23), _mm_set1_epi32(0xff));
+		return _mm_sub_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(127));
+	}
+	static reg mantissa(reg x){
+		__m128i bits = _mm_and_si128(_mm_castps_si128(x), _mm_set1_epi32(0x007fffff));
+		return _mm_castsi128_ps(_mm_or_si128(bits, _mm_set1_epi32(0x3f800000)));
+	}
+};
+#endif
+
+// Natural logarithm for V::width lanes. For normal x > 0 the absolute error is
+// below 1e-12 in double and within float rounding in float; x == 0 gives -inf
+// like log(). Denormal inputs are treated as 2^-1023 (2^-127 in float).
+template <class V, class T>
+inline typename V::reg fastLog(typename V::reg x){
+	typedef typename V::reg reg;
+	reg m = V::mantissa(x);
+	reg e = V::exponent(x);
+	// Center the mantissa on 1: [sqrt(1/2), sqrt(2))
+	typename V::mask high = V::cmpgt(m, V::set1((T)1.4142135623730951));
+	m = V::select(high, V::mul(m, V::set1((T)0.5)), m);
+	e = V::select(high, V::add(e, V::set1((T)1)), e);
+	// log(m) = 2*atanh(s) = 2*(s + s^3/3 + s^5/5 + ...), |s| < 0.1716
+	reg s = V::div(V::sub(m, V::set1((T)1)), V::add(m, V::set1((T)1)));
+	reg s2 = V::mul(s, s);
+	reg p = V::set1((T)(2.0/15));
+	p = V::add(V::mul(p, s2), V::set1((T)(2.0/13)));
+	p = V::add(V::mul(p, s2), V::set1((T)(2.0/11)));
+	p = V::add(V::mul(p, s2), V::set1((T)(2.0/9)));
+	p = V::add(V::mul(p, s2), V::set1((T)(2.0/7)));
+	p = V::add(V::mul(p, s2), V::set1((T)(2.0/5)));
+	p = V::add(V::mul(p, s2), V::set1((T)(2.0/3)));
+	p = V::add(V::mul(p, s2), V::set1((T)2));
+	reg r = V::add(V::mul(e, V::set1((T)0.69314718055994531)), V::mul(s, p));
+	return V::select(V::cmpgt(x, V::zero()), r, V::set1(-std::numeric_limits<T>::infinity()));
+}
+
+const size_t CACHE_LINE = 64;	//bytes
+
+// std::vector allocator placing the elements at an ALIGN byte boundary
+template <class T, size_t ALIGN = CACHE_LINE>
+struct SAlignedAllocator {
+	typedef T value_type;
+	template <class U>
+	struct rebind {
+		typedef SAlignedAllocator<U, ALIGN> other;
+	};
+	SAlignedAllocator() = default;
+	template <class U>
+	SAlignedAllocator(const SAlignedAllocator<U, ALIGN>&) {}
+	T* allocate(size_t n){
+		return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(ALIGN)));
+	}
+	void deallocate(T* p, size_t){
+		::operator delete(p, std::align_val_t(ALIGN));
+	}
+	template <class U>
+	bool operator==(const SAlignedAllocator<U, ALIGN>&) const {
+		return true;
+	}
+	template <class U>
+	bool operator!=(const SAlignedAllocator<U, ALIGN>&) const {
+		return false;
+	}
+};
+#endif
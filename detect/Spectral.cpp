@@ -0,0 +1,105 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "Spectral.hxx"
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+template <>
+map<CFFTPlanCache::PlanKey, fftw_plan>& CFFTPlanCache::plans<double>(){
+	return doublePlans;
+}
+
+template <>
+map<CFFTPlanCache::PlanKey, fftwf_plan>& CFFTPlanCache::plans<float>(){
+	return floatPlans;
+}
+
+template <class T>
+typename SFFTW<T>::plan CFFTPlanCache::getPlan(int n, int howmany){
+	lock_guard<std::mutex> lock(mutex);
+	PlanKey key(n, howmany, flags);
+	auto it = plans<T>().find(key);
+	if (it != plans<T>().end()){
+		return it->second;
+	}
+	T* in = SFFTW<T>::alloc(n*howmany);
+	T* out = SFFTW<T>::alloc(n*howmany);
+	typename SFFTW<T>::plan plan = NULL;
+	if (in && out){
+		plan = SFFTW<T>::planMany(n, howmany, in, out, flags);
+	}
+	SFFTW<T>::free(in);
+	SFFTW<T>::free(out);
+	if (!plan) {
+		fprintf(stderr, "Error: Failed to create FFTW plan\n");
+		exit(1);
+	}
+	plans<T>()[key] = plan;
+	return plan;
+}
+
+template fftw_plan CFFTPlanCache::getPlan<double>(int, int);
+template fftwf_plan CFFTPlanCache::getPlan<float>(int, int);
+
+CFFTPlanCache::~CFFTPlanCache(){
+	for (auto& it : doublePlans){
+		fftw_destroy_plan(it.second);
+	}
+	for (auto& it : floatPlans){
+		fftwf_destroy_plan(it.second);
+	}
+}
+
+size_t CFFTPlanCache::size(){
+	lock_guard<std::mutex> lock(mutex);
+	return doublePlans.size() + floatPlans.size();
+}
+
+bool CFFTPlanCache::importWisdom(const string& filename){
+	lock_guard<std::mutex> lock(mutex);
+	bool d = SFFTW<double>::importWisdom(filename);
+	bool f = SFFTW<float>::importWisdom(filename + ".float");
+	return d || f;
+}
+
+bool CFFTPlanCache::exportWisdom(const string& filename){
+	lock_guard<std::mutex> lock(mutex);
+	bool d = SFFTW<double>::exportWisdom(filename);
+	bool f = SFFTW<float>::exportWisdom(filename + ".float");
+	return d && f;
+}
+
+template <class T>
+void TFFTWEngine<T>::computeFrames(const double * _in, int count, SFrequencies* _out, OrigFrequencies* _oOut){
+	static_assert(sizeof(SFrequencies) == COUNT_FREQ*sizeof(freq_t), "SFrequencies rows must be contiguous");
+	extractor.computeFrames(_in, count, reinterpret_cast<freq_t*>(_out), _oOut);
+}
+
+template class TFFTWEngine<double>;
+template class TFFTWEngine<float>;
+
+unique_ptr<CSpectralEngine> CSpectralEngine::create(FFTPrecision precision){
+	if (precision == FFT_FLOAT){
+		return make_unique<TFFTWEngine<float>>();
+	}
+	return make_unique<TFFTWEngine<double>>();
+}
@@ -0,0 +1,149 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SPECTRAL_HXX
+#define _SPECTRAL_HXX
+#include "Audio.hxx"
+#include "Geometry.hxx"
+#include <mutex>
+#include <tuple>
+
+// Maps the FFTW API of one precision (fftw_ / fftwf_) onto a common name.
+template <class T> struct SFFTW;
+
+template <> struct SFFTW<double> {
+	typedef fftw_plan plan;
+	static double* alloc(size_t n){
+		return (double*)fftw_malloc(n*sizeof(double));
+	}
+	static void free(double* p){
+		fftw_free(p);
+	}
+	static plan planMany(int n, int howmany, double* in, double* out, unsigned flags){
+		fftw_r2r_kind kind = FFTW_R2HC;
+		return fftw_plan_many_r2r(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, &kind, flags);
+	}
+	static void execute(plan p, double* in, double* out){
+		fftw_execute_r2r(p, in, out);
+	}
+	static void destroy(plan p){
+		fftw_destroy_plan(p);
+	}
+	static bool importWisdom(const std::string& filename){
+		return fftw_import_wisdom_from_filename(filename.c_str()) != 0;
+	}
+	static bool exportWisdom(const std::string& filename){
+		return fftw_export_wisdom_to_filename(filename.c_str()) != 0;
+	}
+};
+
+template <> struct SFFTW<float> {
+	typedef fftwf_plan plan;
+	static float* alloc(size_t n){
+		return (float*)fftwf_malloc(n*sizeof(float));
+	}
+	static void free(float* p){
+		fftwf_free(p);
+	}
+	static plan planMany(int n, int howmany, float* in, float* out, unsigned flags){
+		fftwf_r2r_kind kind = FFTW_R2HC;
+		return fftwf_plan_many_r2r(1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, &kind, flags);
+	}
+	static void execute(plan p, float* in, float* out){
+		fftwf_execute_r2r(p, in, out);
+	}
+	static void destroy(plan p){
+		fftwf_destroy_plan(p);
+	}
+	static bool importWisdom(const std::string& filename){
+		return fftwf_import_wisdom_from_filename(filename.c_str()) != 0;
+	}
+	static bool exportWisdom(const std::string& filename){
+		return fftwf_export_wisdom_to_filename(filename.c_str()) != 0;
+	}
+};
+
+// Process-wide cache of FFTW plans shared by all CFFT instances. A plan is
+// created once per precision, transform size, batch size and planner flags on
+// scratch buffers and then executed on the caller's (FFTW-allocated) arrays, so
+// FFTW_MEASURE/FFTW_PATIENT planning never touches live data. Plans live until
+// the process exits.
+class CFFTPlanCache {
+	private:
+		CFFTPlanCache() : flags(FFTW_ESTIMATE) {}
+
+	public:
+		static CFFTPlanCache& getInstance() {
+			static CFFTPlanCache instance;
+			return instance;
+		}
+		~CFFTPlanCache();
+
+		template <class T>
+		typename SFFTW<T>::plan getPlan(int n, int howmany);
+
+		//FFTW_ESTIMATE (default), FFTW_MEASURE or FFTW_PATIENT; affects plans created afterwards
+		void setPlannerFlags(unsigned _flags){
+			flags = _flags;
+		}
+		unsigned getPlannerFlags() const {
+			return flags;
+		}
+		size_t size();
+		// Wisdom of double plans is kept in filename, of float plans in filename + ".float"
+		bool importWisdom(const std::string& filename);
+		bool exportWisdom(const std::string& filename);
+
+		CFFTPlanCache(const CFFTPlanCache&) = delete;
+		CFFTPlanCache& operator=(const CFFTPlanCache&) = delete;
+		CFFTPlanCache(CFFTPlanCache&&) = delete;
+		CFFTPlanCache& operator=(CFFTPlanCache&&) = delete;
+
+	private:
+		typedef std::tuple<int, int, unsigned> PlanKey;	//size, batch, flags
+		template <class T>
+		std::map<PlanKey, typename SFFTW<T>::plan>& plans();
+		std::mutex mutex;	//FFTW planner is not thread safe
+		std::map<PlanKey, fftw_plan> doublePlans;
+		std::map<PlanKey, fftwf_plan> floatPlans;
+		unsigned flags;
+};
+
+// Turns frames of a segment into band (SFrequencies) and, optionally, full
+// (OrigFrequencies) power spectra. Frame i starts at in + i*SEGMENT_FRAMES.
+class CSpectralEngine {
+	public:
+		virtual ~CSpectralEngine() = default;
+		virtual void computeFrames(const double * in, int count, SFrequencies* out, OrigFrequencies* oOut) = 0;
+		static std::unique_ptr<CSpectralEngine> create(FFTPrecision precision);
+};
+
+// FFTW based engine computing the transform in precision T with the default
+// geometry's feature extractor
+template <class T>
+class TFFTWEngine : public CSpectralEngine {
+	public:
+		void computeFrames(const double * in, int count, SFrequencies* out, OrigFrequencies* oOut) override;
+	private:
+		TFeatureExtractor<DefaultGeometry, T> extractor;
+};
+
+extern template class TFFTWEngine<double>;
+extern template class TFFTWEngine<float>;
+#endif
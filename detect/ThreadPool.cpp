@@ -0,0 +1,59 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "ThreadPool.hxx"
+#include <algorithm>
+
+using namespace std;
+
+CThreadPool::CThreadPool(uint threads) : stopping(false){
+	if (threads == 0){
+		threads = max(1u, thread::hardware_concurrency());
+	}
+	for (uint i=0; i<threads; i++){
+		workers.emplace_back(&CThreadPool::run, this);
+	}
+}
+
+CThreadPool::~CThreadPool(){
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (thread& worker : workers){
+		worker.join();
+	}
+}
+
+void CThreadPool::run(){
+	for (;;){
+		function<void()> task;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [this]{ return stopping || !tasks.empty(); });
+			if (tasks.empty()){
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,71 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _THREADPOOL_HXX
+#define _THREADPOOL_HXX
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef unsigned int uint;
+
+// Fixed set of worker threads running submitted tasks in submission order.
+// The destructor finishes the queued tasks and joins the workers.
+class CThreadPool {
+	public:
+		// threads == 0: one per hardware thread
+		explicit CThreadPool(uint threads = 0);
+		~CThreadPool();
+		CThreadPool(const CThreadPool&) = delete;
+		CThreadPool& operator=(const CThreadPool&) = delete;
+
+		uint size() const {
+			return workers.size();
+		}
+		template <class F>
+		std::future<decltype(std::declval<F>()())> submit(F task);
+
+	private:
+		void run();
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+		std::condition_variable wakeUp;
+		bool stopping;
+};
+
+template <class F>
+std::future<decltype(std::declval<F>()())> CThreadPool::submit(F task){
+	typedef decltype(task()) R;
+	// std::function needs a copyable callable, packaged_task is move only
+	auto packaged = std::make_shared<std::packaged_task<R()>>(std::move(task));
+	std::future<R> result = packaged->get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back([packaged](){ (*packaged)(); });
+	}
+	wakeUp.notify_one();
+	return result;
+}
+#endif
@@ -0,0 +1,159 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "VPTree.hxx"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Weight of one octave of frame count against the summed log differences of
+// the bins; differ only accepts frame counts within an octave of each other
+static const float LENGTH_WEIGHT = 1.0f;
+
+static float embeddingDistance(const float* a, const float* b){
+	float d = 0;
+	for (uint i=0; i<EMBEDDING_SIZE; i++){
+		d += fabs(a[i] - b[i]);
+	}
+	return d;
+}
+
+void CVPTree::embed(const CSample& sample, float* out){
+	const vector<SFrequencies>& frequencies = sample.getFrequencies();
+	fill(out, out + EMBEDDING_SIZE, 0.0f);
+	for (const SFrequencies& f : frequencies){
+		for (uint i=0; i<COUNT_FREQ; i++){
+			out[i] += log1p(f.freq[i]);
+		}
+	}
+	for (uint i=0; i<COUNT_FREQ; i++){
+		out[i] /= max<size_t>(frequencies.size(), 1);
+	}
+	out[COUNT_FREQ] = LENGTH_WEIGHT*log2(max<size_t>(frequencies.size(), 1));
+}
+
+CVPTree::CVPTree(const CLearningMatrix& _matrix) : matrix(&_matrix), root(-1){
+	embeddings.resize(matrix->size()*EMBEDDING_SIZE);
+	for (size_t i=0; i<matrix->size(); i++){
+		embed(*matrix->getSample(i), embeddings.data() + i*EMBEDDING_SIZE);
+	}
+	vector<uint> points(matrix->size());
+	for (uint i=0; i<points.size(); i++){
+		points[i] = i;
+	}
+	nodes.reserve(points.size());
+	mt19937 random(1);	//same tree on every run
+	root = build(points, 0, points.size(), random);
+}
+
+int CVPTree::build(vector<uint>& points, size_t from, size_t to, mt19937& random){
+	if (from == to){
+		return -1;
+	}
+	swap(points[from], points[from + random() % (to - from)]);
+	const float* vantage = embedding(points[from]);
+	vector<SCandidate> rest;
+	rest.reserve(to - from - 1);
+	for (size_t i=from+1; i<to; i++){
+		rest.push_back(SCandidate(embeddingDistance(vantage, embedding(points[i])), points[i]));
+	}
+	size_t mid = rest.size()/2;
+	float radius = 0;
+	if (!rest.empty()){
+		nth_element(rest.begin(), rest.begin() + mid, rest.end());
+		radius = rest[mid].first;
+	}
+	for (size_t i=0; i<rest.size(); i++){
+		points[from+1+i] = rest[i].second;
+	}
+	int node = nodes.size();
+	nodes.push_back(SNode{points[from], radius, -1, -1});
+	int inside = build(points, from+1, from+1+mid, random);
+	int outside = build(points, from+1+mid, to, random);
+	nodes[node].inside = inside;
+	nodes[node].outside = outside;
+	return node;
+}
+
+void CVPTree::search(int n, const float* query, size_t count, priority_queue<SCandidate>& best) const {
+	if (n < 0){
+		return;
+	}
+	const SNode& node = nodes[n];
+	float d = embeddingDistance(query, embedding(node.point));
+	if (best.size() < count || d < best.top().first){
+		best.push(SCandidate(d, node.point));
+		if (best.size() > count){
+			best.pop();
+		}
+	}
+	auto tau = [&](){
+		return best.size() < count ? HUGE_VALF : best.top().first;
+	};
+	// An inside point is within tau only if d - tau <= radius, an outside one if d + tau >= radius
+	if (d < node.radius){
+		search(node.inside, query, count, best);
+		if (d + tau() >= node.radius){
+			search(node.outside, query, count, best);
+		}
+	} else {
+		search(node.outside, query, count, best);
+		if (d - tau() <= node.radius){
+			search(node.inside, query, count, best);
+		}
+	}
+}
+
+vector<SNeighbour> CVPTree::candidates(const float* query, size_t count) const {
+	priority_queue<SCandidate> best;
+	if (count > 0){
+		search(root, query, count, best);
+	}
+	vector<SNeighbour> result(best.size());
+	for (size_t i=result.size(); i-- > 0; best.pop()){
+		result[i] = SNeighbour{best.top().second, best.top().first};
+	}
+	return result;
+}
+
+int CVPTree::nearest(CSample& tested, size_t count, double cutoff, double* diff) const {
+	int bestMatch = -1;
+	double bestValue = cutoff;
+	if (!tested.IsNull()){
+		float query[EMBEDDING_SIZE];
+		embed(tested, query);
+		vector<SNeighbour> found = candidates(query, count);
+		// Exact re-ranking, in matrix order as in CLearningMatrix::nearest
+		sort(found.begin(), found.end(), [](const SNeighbour& a, const SNeighbour& b){
+			return a.index < b.index;
+		});
+		for (const SNeighbour& c : found){
+			double tmp = matrix->differ(tested, c.index, bestValue);
+			if (tmp < bestValue){
+				bestValue = tmp;
+				bestMatch = c.index;
+			}
+		}
+	}
+	if (diff != nullptr){
+		*diff = bestValue;
+	}
+	return bestMatch;
+}
@@ -0,0 +1,66 @@
+/*
+	QTDetection, bird voice visualization and comparison.
+	Copyright (C) 2006 Roman Kamyk.
+	 
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _VPTREE_HXX
+#define _VPTREE_HXX
+#include "LearningMatrix.hxx"
+#include <queue>
+#include <random>
+
+// Embedding: mean log(1+x) of every bin over the frames, then the frame count
+const uint EMBEDDING_SIZE = COUNT_FREQ + 1;
+
+// Approximate nearest neighbour index over the samples of a CLearningMatrix.
+// Every sample is embedded in a fixed-length vector; a vantage point tree
+// finds the samples with the nearest embeddings (L1 distance) and only those
+// candidates are compared with the exact CSample::differ. More candidates
+// give a better recall at a higher cost; as many as the matrix has samples
+// give the exact result.
+class CVPTree {
+	public:
+		// matrix must outlive the tree and not be changed
+		explicit CVPTree(const CLearningMatrix& matrix);
+		size_t size() const {
+			return nodes.size();
+		}
+		static void embed(const CSample& sample, float* out);
+		// The count samples (matrix indices) with the nearest embeddings,
+		// nearest first; diff is the embedding distance
+		std::vector<SNeighbour> candidates(const float* embedding, size_t count) const;
+		// CLearningMatrix::nearest among count candidates
+		int nearest(CSample& tested, size_t count, double cutoff, double* diff = nullptr) const;
+	private:
+		struct SNode {
+			uint point;
+			float radius;	//points of inside are not farther, of outside not nearer
+			int inside;
+			int outside;
+		};
+		typedef std::pair<float, uint> SCandidate;	//distance, point
+		const CLearningMatrix* matrix;
+		std::vector<float> embeddings;	//EMBEDDING_SIZE per matrix sample
+		std::vector<SNode> nodes;
+		int root;
+		const float* embedding(uint point) const {
+			return embeddings.data() + (size_t)point*EMBEDDING_SIZE;
+		}
+		int build(std::vector<uint>& points, size_t from, size_t to, std::mt19937& random);
+		void search(int node, const float* query, size_t count, std::priority_queue<SCandidate>& best) const;
+};
+#endif
@@ -20,11 +20,21 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <cstring>
+#include <cstdlib>
 #include <algorithm>
+#include <chrono>
+#include <deque>
 #include <random>
 
 #include "detect.hxx"
 #include "Manager.hxx"
+#include "DistanceMatrix.hxx"
+#include "Geometry.hxx"
+#include "LearningMatrix.hxx"
+#include "Quantized.hxx"
+#include "Spectral.hxx"
+#include "ThreadPool.hxx"
+#include "VPTree.hxx"
 
 using namespace std;
 
@@ -40,69 +50,124 @@ static vector<CSample*> toRawSamples(const vector<unique_ptr<CSample>>& samples)
 bool verbose = false;
 bool printUnknown = true;
 bool crosstest = false;
+bool compareprecision = false;
+bool crossvalidate = false;
 bool applyFilter = true;
 double DIF_CUTOFF = 0.255;
 // double DIF_CUTOFF = 0.24;
 double POWER_CUTOFF = 4e-07;
+uint threadCount = 0;	//classification threads, 0: one per hardware thread
+
+static CThreadPool& classificationPool(){
+	static CThreadPool pool(threadCount);
+	return pool;
+}
+
+struct SMatch {
+	CSample* sample;
+	double diff;
+};
+
+// Nearest neighbour of every sample among the samples of the other folds.
+// Position p of the shuffled set holds samples[order[p]] and belongs to fold
+// p%split; the result is by position.
+static vector<SMatch> crossMatch(const CDistanceMatrix& distances, const vector<CSample*>& samples, const vector<size_t>& order, uint split){
+	const size_t n = order.size();
+	const size_t chunk = 64;
+	vector<SMatch> won(n, SMatch{NULL, DOUBLE_BIG});
+	CThreadPool& pool = classificationPool();
+	vector<future<void>> tasks;
+	for (size_t from=0; from<n; from+=chunk){
+		tasks.push_back(pool.submit([&, from](){
+			for (size_t p=from; p<min(from+chunk, n); p++){
+				SMatch& best = won[p];
+				for (uint k=0; k<split; k++){
+					if (k == p%split){
+						continue;
+					}
+					for (size_t q=k; q<n; q+=split){
+						double tmp = distances(order[p], order[q]);
+						if (tmp < best.diff){
+							best.diff = tmp;
+							best.sample = samples[order[q]];
+						}
+					}
+				}
+			}
+		}));
+	}
+	for (future<void>& task : tasks){
+		task.get();
+	}
+	return won;
+}
+
+unsigned crossTestSeed = std::random_device()();	//fold assignment, -seed
+const char* distanceCache = NULL;	//file the cross-test distances are kept in, -distcache
+const char* condenseFile = NULL;	//-condense
+
+static vector<size_t> shuffledOrder(size_t n){
+	vector<size_t> order(n);
+	for (size_t i=0; i<n; i++){
+		order[i] = i;
+	}
+	std::mt19937 g(crossTestSeed);
+	std::shuffle(order.begin(), order.end(), g);
+	return order;
+}
+
+// Distances between the learning samples, kept in distanceCache when given
+static unique_ptr<CDistanceMatrix> learningDistances(const vector<CSample*>& samples){
+	if (!distanceCache){
+		return make_unique<CDistanceMatrix>(samples, &classificationPool());
+	}
+	unique_ptr<CDistanceMatrix> distances = CDistanceMatrix::cached(samples, distanceCache, &classificationPool());
+	if (verbose){
+		printf("Distances %s %s\n", distances->isMapped() ? "mapped from" : "computed and saved to", distanceCache);
+	}
+	return distances;
+}
 
 void crossTest(vector<CSample*> &samples, uint split = 10){
 	if (verbose) {
 		printf("Rozpoczynam cross-test\n");
 	}
-	std::random_device rd;
-	std::mt19937 g(rd());
-	std::shuffle(samples.begin(), samples.end(), g);
+	printf("Cross-test seed: %u\n", crossTestSeed);
+	unique_ptr<CDistanceMatrix> distances = learningDistances(samples);
+	vector<size_t> order = shuffledOrder(samples.size());
+	vector<SMatch> matches = crossMatch(*distances, samples, order, split);
+	vector<CSample*> shuffled(samples.size());
+	for (size_t i=0; i<order.size(); i++){
+		shuffled[i] = samples[order[i]];
+	}
+	samples = shuffled;
 	map<uint, map<uint, int> > mismatch;
 	map<uint, int> match;
 	map<uint, int> count;
-	vector<vector<CSample*>> ns(split);
 	map<CSample*, int> determinant;
-	for (uint i=0; i<samples.size(); i++){
-		ns[i%split].push_back(samples[i]);		
-	}
 	int dobrze = 0;
 	int ile = 0;
-	for (uint i=0; i<split; i++){
-		for (uint j=0; j<ns[i].size(); j++){
-			double diff = DOUBLE_BIG;
-			CSample* won;
-			ile++;
-			for (uint k=0; k<split; k++){
-				if (k!=i){
-					for (uint l=0; l<ns[k].size(); l++){
-						double tmp = ns[i][j]->differ(*ns[k][l]);
-						if (verbose) {
-							if ((k+l)%10 == 0){	//"progress bar"
-								printf("\r%3d", (i+j+k+l)%100);
-							}
-						}
-#ifdef _DEBUG
-						fprintf(stderr, "%s-%s: %f\n", ns[i][j]->getName().c_str(), ns[k][l]->getName().c_str(), tmp);
-#endif
-						if (tmp < diff){
-							diff = tmp;
-							won = ns[k][l];
-						}
-					}
-				}
-			}
-			const double CUTOFF = DIF_CUTOFF;
-			if (won->getBirdId() == ns[i][j]->getBirdId() && diff < CUTOFF){
-				determinant[won]++;
-				dobrze++;
-				match[won->getBirdId()]++;
-				Dprintf("Trafiony zatopiony: %u (roznica: %f)\n", won->getBirdId(), diff);
+	for (uint i=0; i<samples.size(); i++){
+		CSample* tested = samples[i];
+		CSample* won = matches[i].sample;
+		double diff = matches[i].diff;
+		ile++;
+		const double CUTOFF = DIF_CUTOFF;
+		if (won->getBirdId() == tested->getBirdId() && diff < CUTOFF){
+			determinant[won]++;
+			dobrze++;
+			match[won->getBirdId()]++;
+			Dprintf("Trafiony zatopiony: %u (roznica: %f)\n", won->getBirdId(), diff);
+		} else {
+			Dprintf("Uuuupppsss... %s wziety za %s (roznica: %f)\n", tested->getName().c_str(), won->getName().c_str(), diff);
+			if (diff >= CUTOFF){
+				mismatch[tested->getBirdId()][0]++;
 			} else {
-				Dprintf("Uuuupppsss... %s wziety za %s (roznica: %f)\n", ns[i][j]->getName().c_str(), won->getName().c_str(), diff);
-				if (diff >= CUTOFF){
-					mismatch[ns[i][j]->getBirdId()][0]++;
-				} else {
-					mismatch[ns[i][j]->getBirdId()][won->getBirdId()]++;
-				}
-				determinant[won]--;
+				mismatch[tested->getBirdId()][won->getBirdId()]++;
 			}
-			count[ns[i][j]->getBirdId()]++;
+			determinant[won]--;
 		}
+		count[tested->getBirdId()]++;
 	}
 	printf("\nCross-test results: %d/%d (%3.2f%%)\n", dobrze, ile, 100.0*dobrze/ile);
 	for (map<uint, int>::iterator it = count.begin(); it != count.end(); it++){
@@ -137,13 +202,274 @@ void crossTest(vector<CSample*> &samples, uint split = 10){
 		}
 	}
 	test(toTest, learning);
-	auto categories = categorize(learning, 0.200);
+	auto categories = categorize(learning, 0.200, &classificationPool());
 	auto cats = toRawSamples(categories);
 	saveSamplesToFile(cats, "categories.freq");
 	test(samples, cats);
 	// saveSamples(cats, "categories/", true);
 }
 
+// Runs body(from, to) over [0, n) in chunks, on pool when given
+template<class Body>
+static void forChunks(size_t n, size_t chunk, CThreadPool* pool, Body body){
+	if (pool == nullptr || n <= chunk){
+		body((size_t)0, n);
+		return;
+	}
+	vector<future<void>> tasks;
+	for (size_t from=0; from<n; from+=chunk){
+		tasks.push_back(pool->submit([&body, from, n, chunk](){
+			body(from, min(from + chunk, n));
+		}));
+	}
+	for (future<void>& task : tasks){
+		task.get();
+	}
+}
+
+// Whether sample i is recognized by its nearest neighbour j at distance diff,
+// as in the cross-test
+static bool recognized(const vector<CSample*>& samples, size_t i, size_t j, double diff, double cutoff){
+	return j != SIZE_MAX && samples[j]->getBirdId() == samples[i]->getBirdId() && diff < cutoff;
+}
+
+vector<size_t> condense(const vector<CSample*>& samples, const CDistanceMatrix& distances, double cutoff, CThreadPool* pool, size_t* edited){
+	const size_t n = samples.size();
+	const size_t chunk = 1024;
+	// Editing (Wilson): drop samples whose 3 nearest neighbours within cutoff
+	// are mostly of other species
+	const size_t K = 3;
+	vector<char> keep(n, 1);
+	forChunks(n, chunk, pool, [&](size_t from, size_t to){
+		for (size_t i=from; i<to; i++){
+			pair<float, size_t> nearest[K];
+			size_t found = 0;
+			for (size_t j=0; j<n; j++){
+				if (j == i){
+					continue;
+				}
+				pair<float, size_t> candidate(distances(i, j), j);
+				if (found == K && !(candidate < nearest[K-1])){
+					continue;
+				}
+				size_t k = found < K ? found++ : K-1;
+				while (k > 0 && candidate < nearest[k-1]){
+					nearest[k] = nearest[k-1];
+					k--;
+				}
+				nearest[k] = candidate;
+			}
+			int votes = 0;
+			for (size_t k=0; k<found; k++){
+				if (nearest[k].first < cutoff){
+					votes += samples[nearest[k].second]->getBirdId() == samples[i]->getBirdId() ? 1 : -1;
+				}
+			}
+			keep[i] = votes >= 0;
+		}
+	});
+	vector<size_t> members;
+	for (size_t i=0; i<n; i++){
+		if (keep[i]){
+			members.push_back(i);
+		}
+	}
+	if (edited){
+		*edited = n - members.size();
+	}
+	// Condensing (Hart): pass over the members, storing every one the store
+	// doesn't recognize yet, until a pass stores none. The nearest stored
+	// sample of every member is kept up to date as the store grows.
+	const size_t m = members.size();
+	vector<size_t> nearest(m, SIZE_MAX);	//index into samples
+	vector<double> nearestDiff(m, HUGE_VAL);
+	vector<char> stored(m, 0);
+	auto store = [&](size_t s){
+		stored[s] = 1;
+		forChunks(m, chunk*16, pool, [&](size_t from, size_t to){
+			for (size_t p=from; p<to; p++){
+				double tmp = distances(members[p], members[s]);
+				if (tmp < nearestDiff[p]){
+					nearestDiff[p] = tmp;
+					nearest[p] = members[s];
+				}
+			}
+		});
+	};
+	for (bool added = true; added; ){
+		added = false;
+		for (size_t p=0; p<m; p++){
+			if (!stored[p] && !recognized(samples, members[p], nearest[p], nearestDiff[p], cutoff)){
+				store(p);
+				added = true;
+			}
+		}
+	}
+	// Reduction (Gates): drop a stored sample when every member it is the
+	// nearest of, itself included, is still recognized by the rest
+	vector<size_t> kept;
+	for (size_t p=0; p<m; p++){
+		if (stored[p]){
+			kept.push_back(members[p]);
+		}
+	}
+	vector<char> dropped(n, 0);
+	for (size_t r : kept){
+		vector<size_t> affected;
+		for (size_t p=0; p<m; p++){
+			if (nearest[p] == r || members[p] == r){
+				affected.push_back(p);
+			}
+		}
+		vector<size_t> replacement(affected.size(), SIZE_MAX);
+		vector<double> replacementDiff(affected.size(), HUGE_VAL);
+		bool removable = true;
+		for (size_t a=0; a<affected.size() && removable; a++){
+			size_t p = affected[a];
+			for (size_t s : kept){
+				if (s == r || dropped[s]){
+					continue;
+				}
+				double tmp = distances(members[p], s);
+				if (tmp < replacementDiff[a]){
+					replacementDiff[a] = tmp;
+					replacement[a] = s;
+				}
+			}
+			removable = recognized(samples, members[p], replacement[a], replacementDiff[a], cutoff);
+		}
+		if (removable){
+			dropped[r] = 1;
+			for (size_t a=0; a<affected.size(); a++){
+				if (nearest[affected[a]] == r){
+					nearest[affected[a]] = replacement[a];
+					nearestDiff[affected[a]] = replacementDiff[a];
+				}
+			}
+		}
+	}
+	kept.erase(remove_if(kept.begin(), kept.end(), [&dropped](size_t s){
+		return dropped[s] != 0;
+	}), kept.end());
+	return kept;
+}
+
+// Share of samples recognized by their nearest other sample of reference
+static double leaveOneOutAccuracy(const vector<CSample*>& samples, const CDistanceMatrix& distances, const vector<size_t>& reference, double cutoff){
+	vector<char> hit(samples.size(), 0);
+	forChunks(samples.size(), 64, &classificationPool(), [&](size_t from, size_t to){
+		for (size_t i=from; i<to; i++){
+			size_t best = SIZE_MAX;
+			double bestDiff = HUGE_VAL;
+			for (size_t j : reference){
+				double tmp = distances(i, j);
+				if (j != i && tmp < bestDiff){
+					bestDiff = tmp;
+					best = j;
+				}
+			}
+			hit[i] = recognized(samples, i, best, bestDiff, cutoff);
+		}
+	});
+	return samples.empty() ? 0 : 100.0*count(hit.begin(), hit.end(), 1)/samples.size();
+}
+
+// Condenses the learning set into fileName and reports what it costs
+void condenseLearning(vector<CSample*>& samples, const char* fileName){
+	unique_ptr<CDistanceMatrix> distances = learningDistances(samples);
+	size_t edited = 0;
+	vector<size_t> kept = condense(samples, *distances, DIF_CUTOFF, &classificationPool(), &edited);
+	vector<CSample*> condensed;
+	for (size_t i : kept){
+		condensed.push_back(samples[i]);
+	}
+	saveSamplesToFile(condensed, fileName);
+	vector<size_t> all(samples.size());
+	for (size_t i=0; i<all.size(); i++){
+		all[i] = i;
+	}
+	double before = leaveOneOutAccuracy(samples, *distances, all, DIF_CUTOFF);
+	double after = leaveOneOutAccuracy(samples, *distances, kept, DIF_CUTOFF);
+	printf("Condensed %d learning samples to %d (%3.2f%%, %d edited out) in %s\n", (int)samples.size(), (int)kept.size(), samples.empty() ? 0 : 100.0*kept.size()/samples.size(), (int)edited, fileName);
+	printf("Leave-one-out accuracy: %3.2f%% -> %3.2f%% (%+3.2f)\n", before, after, after - before);
+}
+
+// Extracts the learning set with double and float transforms and reports how
+// far apart the features and the cross-test results of both pipelines are.
+void comparePrecision(const char* dirName, CManager& manager, CFFT& fft, uint split = 10){
+	FFTPrecision previous = fft.getPrecision();
+	vector<unique_ptr<CSample>> sets[2];
+	const FFTPrecision precisions[2] = {FFT_DOUBLE, FFT_FLOAT};
+	for (int p=0; p<2; p++){
+		fft.setPrecision(precisions[p]);
+		manager.setSavePrefix("");	//restarts sample ids, so both sets share them
+		sets[p] = readLearning(dirName, manager);
+	}
+	fft.setPrecision(previous);
+	map<uint, CSample*> floats;
+	for (const auto& sample : sets[1]){
+		floats[sample->getId()] = sample.get();
+	}
+	vector<CSample*> pairs[2];
+	double maxDev = 0;
+	double sumDev = 0;
+	size_t bins = 0;
+	for (const auto& sample : sets[0]){
+		map<uint, CSample*>::iterator it = floats.find(sample->getId());
+		if (it == floats.end() || it->second->getFreqCount() != sample->getFreqCount()){
+			continue;
+		}
+		pairs[0].push_back(sample.get());
+		pairs[1].push_back(it->second);
+		for (size_t i=0; i<sample->getFreqCount(); i++){
+			const SFrequencies& a = sample->getFrequencies()[i];
+			const SFrequencies& b = it->second->getFrequencies()[i];
+			for (uint j=0; j<COUNT_FREQ; j++){
+				double dev = fabs((double)a.freq[j] - (double)b.freq[j]);
+				maxDev = max(maxDev, dev);
+				sumDev += dev;
+				bins++;
+			}
+		}
+	}
+	size_t n = pairs[0].size();
+	printf("Precision comparison: %d double, %d float samples, %d paired\n", (int)sets[0].size(), (int)sets[1].size(), (int)n);
+	if (n < split){
+		return;
+	}
+	printf("Feature deviation: max %g, mean %g\n", maxDev, sumDev/bins);
+	// Same fold assignment for both pipelines
+	printf("Cross-test seed: %u\n", crossTestSeed);
+	vector<size_t> order = shuffledOrder(n);
+	vector<SMatch> matches[2];
+	map<CSample*, size_t> position[2];
+	int good[2] = {0, 0};
+	for (int p=0; p<2; p++){
+		vector<CSample*> shuffled(n);
+		for (size_t i=0; i<n; i++){
+			shuffled[i] = pairs[p][order[i]];
+			position[p][shuffled[i]] = i;
+		}
+		matches[p] = crossMatch(CDistanceMatrix(pairs[p], &classificationPool()), pairs[p], order, split);
+		for (size_t i=0; i<n; i++){
+			if (matches[p][i].sample->getBirdId() == shuffled[i]->getBirdId() && matches[p][i].diff < DIF_CUTOFF){
+				good[p]++;
+			}
+		}
+	}
+	int same = 0;
+	double maxDiffDev = 0;
+	for (size_t i=0; i<n; i++){
+		if (position[0][matches[0][i].sample] == position[1][matches[1][i].sample]){
+			same++;
+		}
+		maxDiffDev = max(maxDiffDev, fabs(matches[0][i].diff - matches[1][i].diff));
+	}
+	printf("Cross-test double: %d/%d (%3.2f%%)\n", good[0], (int)n, 100.0*good[0]/n);
+	printf("Cross-test float:  %d/%d (%3.2f%%)\n", good[1], (int)n, 100.0*good[1]/n);
+	printf("Same nearest neighbour: %d/%d (%3.2f%%), max difference deviation: %g\n", same, (int)n, 100.0*same/n, maxDiffDev);
+}
+
 void test(vector<CSample*>& samples, vector<CSample*>& learning){
 	printf("Beginning test\n");
 	map<uint, map<uint, int> > mismatch;
@@ -153,19 +479,13 @@ void test(vector<CSample*>& samples, vector<CSample*>& learning){
 	int count = 0;
 	double minBad = 100.0;
 	double maxGood = 0;
+	CLearningMatrix matrix(learning);
+	vector<double> bestValues;
+	vector<int> best = matrix.nearest(samples, 100, &bestValues, &classificationPool());
 	for (uint i=0; i<samples.size(); i++){
-		CSample* bestMatch = NULL;
-		double bestValue = 100;
+		double bestValue = bestValues[i];
 		const double CUTOFF = DIF_CUTOFF;
-		for (uint j=0; j<learning.size(); j++){
-			// double tmp = samples[i]->similar(*learning[j]);
-			// if (bestValue < tmp){
-			double tmp = samples[i]->differ(*learning[j]);
-			if (tmp < bestValue){
-				bestValue = tmp;
-				bestMatch = learning[j];
-			}
-		}
+		CSample* bestMatch = best[i] < 0 ? NULL : matrix.getSample(best[i]);
 		if (bestMatch->getBirdId() == samples[i]->getBirdId()){
 			maxGood = max(maxGood, bestValue);
 			++good;
@@ -197,121 +517,178 @@ void test(vector<CSample*>& samples, vector<CSample*>& learning){
 }
 
 //0.075
-vector<unique_ptr<CSample>> categorize(vector<CSample*>& samples, double delta){
-	printf("Begining categorization\n");
-	vector<unique_ptr<CSample>> categories;
-	int blad = 0;
-	for (uint i=0; i<samples.size(); i++){
-		double bestValue = 100;
+// Categories of one species, built from its samples (indices into samples)
+// in order. created[c] is the index of the sample that started category c.
+static void categorizeSpecies(const vector<CSample*>& samples, const vector<size_t>& members, double delta, vector<unique_ptr<CSample>>& categories, vector<size_t>& created){
+	// Only a category within delta is joined; farther ones are pruned and abandoned
+	const double limit = nextafter(delta, HUGE_VAL);
+	for (size_t i : members){
+		CSample* sample = samples[i];
+		if (!sample->isPrepared()){
+			sample->prepare();
+		}
+		double bestValue = limit;
 		CSample * bestCat = NULL;
-		for (uint j=0; j<categories.size(); j++){
-			if (categories[j]->getName()!=samples[i]->getName()){
+		for (const auto& category : categories){
+			if (sample->lowerBound(*category, bestValue) >= bestValue){
 				continue;
 			}
-			// double tmp = samples[i]->similar(*categories[j]);
-			double tmp = samples[i]->differ(*categories[j]);
-			// double tmp = samples[i]->correlation(*categories[j]);
-			// if (tmp > bestValue){
+			double tmp = sample->differ(*category, bestValue);
 			if (tmp < bestValue){
 				bestValue = tmp;
-				bestCat = categories[j].get();
+				bestCat = category.get();
 			}
 		}
-		// if (bestCat == NULL || bestValue < delta){
-		if (bestCat == NULL || bestValue > delta){
-			categories.push_back(make_unique<CSample>(*samples[i]));
+		if (bestCat == NULL){
+			categories.push_back(make_unique<CSample>(*sample));
+			created.push_back(i);
 		} else {
-			bestCat->consume(*samples[i]);
-			// if (bestCat->getName() != samples[i]->getName()){
-			// 	// printf("Uuuupppsss... %s wziety za %s\n", samples[i]->getName().c_str(), bestCat->getName().c_str());
-			// 	blad++;
-			// } else {
-			// 	// printf("Correlation: %f\n", samples[i]->correlation(*bestCat));
-			// }
-		}
-	}
-	printf("Made %d categories with %d errors\n", (int)categories.size(), blad);
-	// char buf[100];
-	// for (uint i=0; i<categories.size(); i++){
-	// 	sprintf(buf, "categories/%i.wav", i);
-	// 	categories[i]->saveAudio(buf);
-	// 	sprintf(buf, "categories/%i.freq", i);
-	// 	categories[i]->saveFrequencies(buf);
-	// }
-	//test(samples, categories);
-	return categories;
+			bestCat->consume(*sample);
+		}
+	}
 }
 
-void categorize2(vector<CSample*> samples, double delta = 1.25){
+// Merges every sample into the nearest category of its species within delta,
+// or starts a new category with it. Species are independent, so they are
+// categorized on pool when given.
+vector<unique_ptr<CSample>> categorize(vector<CSample*>& samples, double delta, CThreadPool* pool){
 	printf("Begining categorization\n");
-	vector<unique_ptr<CSample>> categories;
-	int blad = 0;
-	for (uint i=0; i<samples.size(); i++){
-		double bestValue = 100;
-		CSample * bestCat = NULL;
-		for (uint j=0; j<categories.size(); j++){
-			if (categories[j]->getName()!=samples[i]->getName()){
-				continue;
-			}
-			// double tmp = samples[i]->similar(*categories[j]);
-			double tmp = samples[i]->differ(*categories[j]);
-			// double tmp = samples[i]->correlation(*categories[j]);
-			// if (tmp > bestValue){
-			if (tmp < bestValue){
-				bestValue = tmp;
-				bestCat = categories[j].get();
-			}
-		}
-		// if (bestCat == NULL || bestValue < delta){
-		if (bestCat == NULL || bestValue > delta){
-			categories.push_back(make_unique<CSample>(*samples[i]));
+	map<uint, vector<size_t>> species;	//sample indices by bird id
+	for (size_t i=0; i<samples.size(); i++){
+		species[samples[i]->getBirdId()].push_back(i);
+	}
+	struct SSpecies {
+		const vector<size_t>* members;
+		vector<unique_ptr<CSample>> categories;
+		vector<size_t> created;
+	};
+	vector<SSpecies> parts;
+	for (const auto& s : species){
+		parts.push_back(SSpecies{&s.second, {}, {}});
+	}
+	vector<future<void>> tasks;
+	for (SSpecies& part : parts){
+		auto task = [&samples, delta, &part](){
+			categorizeSpecies(samples, *part.members, delta, part.categories, part.created);
+		};
+		if (pool != nullptr){
+			tasks.push_back(pool->submit(task));
 		} else {
-			bestCat->consume(*samples[i]);
-			// if (bestCat->getName() != samples[i]->getName()){
-			// 	// printf("Uuuupppsss... %s wziety za %s\n", samples[i]->getName().c_str(), bestCat->getName().c_str());
-			// 	blad++;
-			// } else {
-			// 	// printf("Correlation: %f\n", samples[i]->correlation(*bestCat));
-			// }
-		}
-	}
-	printf("Made %d categories with %d errors\n", (int)categories.size(), blad);
-	// char buf[100];
-	// for (uint i=0; i<categories.size(); i++){
-	// 	sprintf(buf, "categories/%i.wav", i);
-	// 	categories[i]->saveAudio(buf);
-	// 	sprintf(buf, "categories/%i.freq", i);
-	// 	categories[i]->saveFrequencies(buf);
-	// }
+			task();
+		}
+	}
+	for (future<void>& task : tasks){
+		task.get();
+	}
+	// In the order their first samples came in, as if made in one pass
+	vector<pair<size_t, unique_ptr<CSample>>> ordered;
+	for (SSpecies& part : parts){
+		for (size_t c=0; c<part.categories.size(); c++){
+			ordered.emplace_back(part.created[c], std::move(part.categories[c]));
+		}
+	}
+	sort(ordered.begin(), ordered.end(), [](const pair<size_t, unique_ptr<CSample>>& a, const pair<size_t, unique_ptr<CSample>>& b){
+		return a.first < b.first;
+	});
+	vector<unique_ptr<CSample>> categories;
+	categories.reserve(ordered.size());
+	for (auto& category : ordered){
+		categories.push_back(std::move(category.second));
+	}
+	printf("Made %d categories\n", (int)categories.size());
+	return categories;
+}
+
+void categorize2(vector<CSample*> samples, double delta = 1.25){
+	auto categories = categorize(samples, delta, &classificationPool());
 	auto cats = toRawSamples(categories);
 	test(samples, cats);
 }
 
-CSample * test(CSample * tested, vector<CSample*>& learning, bool print){
-	CSample* bestMatch = NULL;
-	double bestValue = DIF_CUTOFF;
+// Nearest learning sample of a tested sample, as reported by printMatch
+struct SMatchResult {
+	bool found;
+	uint id;
+	uint birdId;
+	double value;
+};
+
+// One result line: tested sample, matched sample id and species (UNKN if none)
+static void printMatch(const CSample* tested, const SMatchResult& match){
+	if (match.found) {
+		printf("%08u %04u %s %u %u %g\n", tested->getId(), match.id, birdShortNameFromId(match.birdId), tested->getStartSampleNo(), tested->getEndSampleNo(), match.value);
+	} else if (printUnknown) {
+		printf("%08u 0000 UNKN %u %u %g\n", tested->getId(), tested->getStartSampleNo(), tested->getEndSampleNo(), match.value);
+	}
+}
+
+// Nearest learning sample below DIF_CUTOFF. Only tested is modified (prepared),
+// so calls for different tested samples may run in parallel.
+static SMatch nearest(CSample* tested, vector<CSample*>& learning){
+	SMatch best = {NULL, DIF_CUTOFF};
+	if (!tested->isPrepared()){
+		tested->prepare();
+	}
+	unsigned long long pruned = 0;
 	for (uint j=0; j<learning.size(); j++){
-		double tmp = tested->differ(*learning[j]);
-		if (tmp < bestValue){
-			bestValue = tmp;
-			bestMatch = learning[j];
+		// Skipped without touching the frames when the envelopes rule it out
+		if (tested->lowerBound(*learning[j], best.diff) >= best.diff){
+			++pruned;
+			continue;
+		}
+		double tmp = tested->differ(*learning[j], best.diff);
+		if (tmp < best.diff){
+			best.diff = tmp;
+			best.sample = learning[j];
 		}
 	}
+	SPruningStats::getInstance().add(learning.size(), pruned);
+	return best;
+}
+
+static SMatchResult toResult(const SMatch& match){
+	if (match.sample == NULL){
+		return SMatchResult{false, 0, 0, match.diff};
+	}
+	return SMatchResult{true, match.sample->getId(), match.sample->getBirdId(), match.diff};
+}
+
+static SMatch nearest(CSample* tested, const CLearningMatrix& learning){
+	SMatch best;
+	int i = learning.nearest(*tested, DIF_CUTOFF, &best.diff);
+	best.sample = i < 0 ? NULL : learning.getSample(i);
+	return best;
+}
+
+CSample * test(CSample * tested, vector<CSample*>& learning, bool print){
+	SMatch best = nearest(tested, learning);
 	if (print) {
-		if (bestMatch != NULL) {
-			printf("%08u %04u %s %u %u %g\n", tested->getId(), bestMatch->getId(), birdShortNameFromId(bestMatch->getBirdId()), tested->getStartSampleNo(), tested->getEndSampleNo(), bestValue);
-		} else {
-			if (printUnknown) {
-				printf("%08u 0000 UNKN %u %u %g\n", tested->getId(), tested->getStartSampleNo(), tested->getEndSampleNo(), bestValue);
-			}
-		}
+		printMatch(tested, toResult(best));
 	}
-	return bestMatch;
+	return best.sample;
+}
+
+CSample * test(CSample * tested, const CLearningMatrix& learning, bool print){
+	SMatch best = nearest(tested, learning);
+	if (print) {
+		printMatch(tested, toResult(best));
+	}
+	return best.sample;
 }
 
 void analyze(vector<CSample*>& samples, vector<CSample*>& learning){
+	analyze(samples, CLearningMatrix(learning));
+}
+
+void analyze(vector<CSample*>& samples, const CLearningMatrix& learning){
+	vector<double> bestValues;
+	vector<int> best = learning.nearest(samples, DIF_CUTOFF, &bestValues, &classificationPool());
 	for (uint i=0; i<samples.size(); i++){
-		test (samples[i], learning, true);
+		if (best[i] < 0){
+			printMatch(samples[i], SMatchResult{false, 0, 0, bestValues[i]});
+		} else {
+			printMatch(samples[i], SMatchResult{true, learning.getId(best[i]), learning.getBirdId(best[i]), bestValues[i]});
+		}
 	}
 }
 
@@ -351,6 +728,7 @@ vector<unique_ptr<CSample>> readLearning(const char* dirName, CManager& manager
 		if (sample->IsNull()){
 			continue;
 		}
+		sample->prepare();
 		samples.push_back(std::move(sample));
 #ifdef QT_CORE_LIB
 		if (progress != NULL){
@@ -367,29 +745,172 @@ vector<unique_ptr<CSample>> readLearning(const char* dirName, CManager& manager
 	return samples;
 }
 
-void analyzeDarlowo(const char* filename, vector<CSample*>& learning, CManager& manager){
+// Queues filename as the only file of the manager, with the analysis settings
+static void startAnalysis(const char* filename, CManager& manager){
 	manager.resetQueue();
 	manager.addFile(filename);
 	manager.setPowerCutoff(POWER_CUTOFF);
 	if (applyFilter){
 		manager.setFilter(&MP3Filter);
 	}
-	printf("Beginning analysis of %s.\n", filename);
-	vector<CSample*> testSamples;
-	CSample* cs;
+}
+
+// Classifies every sample the manager finds in the queued file on the
+// classification pool while the reader moves on, and prints the results in
+// file order. At most a few samples per thread are in flight.
+template <class Classify, class Print>
+static void classifySamples(CManager& manager, Classify classify, Print print){
+	CThreadPool& pool = classificationPool();
+	const size_t window = 4*pool.size();
+	typedef decltype(classify(std::declval<CSample&>())) Result;
+	deque<pair<unique_ptr<CSample>, future<Result>>> pending;
+	auto printFirst = [&pending, &print](){
+		print(pending.front().first.get(), pending.front().second.get());
+		pending.pop_front();
+	};
 	for (;;){
-		cs = manager.getSample();
-		if (cs == NULL){
+		unique_ptr<CSample> cs(manager.getSample());
+		if (!cs){
 			break;
 		}
 		if (cs->IsNull()){
-			delete cs;
 			continue;
 		}
-		testSamples.push_back(cs);
-		analyze(testSamples, learning);
-		testSamples.pop_back();
-		delete cs;
+		CSample* sample = cs.get();
+		pending.emplace_back(std::move(cs), pool.submit([sample, &classify](){
+			return classify(*sample);
+		}));
+		while (pending.size() > window){
+			printFirst();
+		}
+	}
+	while (!pending.empty()){
+		printFirst();
+	}
+}
+
+// Every match of a tested sample on its own line, as printMatch
+static void printMatches(const CSample* tested, const CLearningMatrix& learning, const vector<SNeighbour>& matches){
+	if (matches.empty()){
+		printMatch(tested, SMatchResult{false, 0, 0, DIF_CUTOFF});
+	}
+	for (const SNeighbour& match : matches){
+		printMatch(tested, SMatchResult{true, learning.getId(match.index), learning.getBirdId(match.index), match.diff});
+	}
+}
+
+uint topMatches = 0;	//print this many best matches per sample instead of one
+bool perSpecies = false;	//print the best match of every species
+
+uint annCandidates = 0;	//candidates re-ranked per query with the approximate index, 0: exact scan
+
+// Recall of the approximate index against the exact scan, and both timings
+static void annRecall(vector<CSample*>& samples, vector<CSample*>& learning){
+	CLearningMatrix matrix(learning);
+	CThreadPool& pool = classificationPool();
+	auto start = chrono::steady_clock::now();
+	vector<int> exact = matrix.nearest(samples, DIF_CUTOFF, nullptr, &pool);
+	chrono::duration<double> exactTime = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	CVPTree index(matrix);
+	chrono::duration<double> buildTime = chrono::steady_clock::now() - start;
+	start = chrono::steady_clock::now();
+	vector<future<int>> approximate;
+	for (CSample* sample : samples){
+		approximate.push_back(pool.submit([&index, sample](){
+			return index.nearest(*sample, annCandidates, DIF_CUTOFF);
+		}));
+	}
+	int found = 0;
+	int same = 0;
+	for (uint i=0; i<samples.size(); i++){
+		int match = approximate[i].get();
+		if (exact[i] >= 0){
+			++found;
+			same += match == exact[i];
+		}
+	}
+	chrono::duration<double> annTime = chrono::steady_clock::now() - start;
+	printf("ANN recall (%u candidates): %d/%d (%3.2f%%)\n", annCandidates, same, found, found ? 100.0*same/found : 100.0);
+	printf("Exact scan %.3fs, ANN %.3fs (+%.3fs index build)\n", exactTime.count(), annTime.count(), buildTime.count());
+}
+
+void analyzeDarlowo(const char* filename, const CLearningMatrix& learning, CManager& manager, const CVPTree* index = nullptr){
+	startAnalysis(filename, manager);
+	printf("Beginning analysis of %s.\n", filename);
+	auto print = [&learning](const CSample* tested, const vector<SNeighbour>& matches){
+		printMatches(tested, learning, matches);
+	};
+	if (perSpecies){
+		classifySamples(manager, [&learning](CSample& sample){
+			return learning.nearestPerSpecies(sample, DIF_CUTOFF);
+		}, print);
+	} else if (topMatches > 0){
+		classifySamples(manager, [&learning](CSample& sample){
+			return learning.nearestK(sample, topMatches, DIF_CUTOFF);
+		}, print);
+	} else if (index != nullptr){
+		classifySamples(manager, [&learning, index](CSample& sample){
+			double bestValue;
+			int bestMatch = index->nearest(sample, annCandidates, DIF_CUTOFF, &bestValue);
+			return toResult(SMatch{bestMatch < 0 ? NULL : learning.getSample(bestMatch), bestValue});
+		}, printMatch);
+	} else {
+		classifySamples(manager, [&learning](CSample& sample){
+			return toResult(nearest(&sample, learning));
+		}, printMatch);
+	}
+}
+
+// analyzeDarlowo for a learning set in a non-default feature geometry: the
+// manager still segments the file, each segment is classified by the model
+void analyzeWithModel(const char* filename, const CFeatureModel& model, CManager& manager){
+	startAnalysis(filename, manager);
+	printf("Beginning analysis of %s (%s features).\n", filename, model.getGeometry().name);
+	classifySamples(manager, [&model](CSample& sample){
+		const vector<double>& frames = sample.getFrames();
+		double bestValue;
+		const SModelSample* bestMatch = model.classify(frames.data(), frames.size(), DIF_CUTOFF, &bestValue);
+		if (bestMatch == NULL){
+			return SMatchResult{false, 0, 0, bestValue};
+		}
+		return SMatchResult{true, bestMatch->id, bestMatch->birdId, bestValue};
+	}, printMatch);
+}
+
+// analyzeDarlowo against a learning set kept as quantized features
+template <class Q>
+void analyzeQuantized(const char* filename, const TQuantizedSet<Q>& learning, CManager& manager){
+	startAnalysis(filename, manager);
+	printf("Beginning analysis of %s (%d-bit features).\n", filename, (int)(8*sizeof(Q)));
+	classifySamples(manager, [&learning](CSample& sample){
+		double bestValue;
+		int bestMatch = learning.nearest(sample, DIF_CUTOFF, &bestValue);
+		if (bestMatch < 0){
+			return SMatchResult{false, 0, 0, bestValue};
+		}
+		return SMatchResult{true, learning.getId(bestMatch), learning.getBirdId(bestMatch), bestValue};
+	}, printMatch);
+}
+
+// Times the spectral engine in both precisions on the same noise signal
+void benchmarkEngines(int frames = 20000){
+	vector<double> signal(FFT_SIZE + (frames-1)*SEGMENT_FRAMES);
+	std::mt19937 g(1);
+	std::uniform_real_distribution<double> noise(-1.0, 1.0);
+	for (size_t i=0; i<signal.size(); i++){
+		signal[i] = noise(g);
+	}
+	vector<SFrequencies> out(frames);
+	const FFTPrecision precisions[] = {FFT_DOUBLE, FFT_FLOAT};
+	const char* precisionNames[] = {"double", "float"};
+	for (int p=0; p<2; p++){
+		CFFT fft(precisions[p]);
+		fft.computeFrames(signal.data(), STFT_BATCH, out.data());	//plans and caches
+		auto start = std::chrono::steady_clock::now();
+		fft.computeFrames(signal.data(), frames, out.data());
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		printf("fftw %-6s: %10.0f frames/s\n", precisionNames[p], frames/elapsed.count());
 	}
 }
 
@@ -406,7 +927,28 @@ void print_help(char* name){
 	printf("  -verbose              Enable verbose output\n");
 	printf("  -nofilter             Disable bandpass filter (2-14 kHz)\n");
 	printf("  -nounknown            Don't report unrecognized voices\n");
-	printf("  -crosstest            Perform 10-fold cross-validation on learning set\n\n");
+	printf("  -crosstest            Perform 10-fold cross-validation on learning set\n");
+	printf("  -precision <p>        FFT precision: double (default) or float\n");
+	printf("  -compareprecision     With -crosstest, compare float and double features\n");
+	printf("  -seed <n>             Seed of the cross-test fold assignment (default: random)\n");
+	printf("  -crossvalidate        10-fold cross-validation of the learning set; writes the\n");
+	printf("                        chosen samples' categories to categories.freq\n");
+	printf("  -distcache <file>     Keep the cross-validation distances in file and reuse\n");
+	printf("                        them while the learning set is unchanged\n");
+	printf("  -condense <file>      Write the smallest learning subset that still recognizes\n");
+	printf("                        the learning set to file and report its accuracy\n");
+	printf("  -wisdom <file>        Load FFTW wisdom at startup and save it at exit\n");
+	printf("  -planner <mode>       FFTW planner: estimate (default), measure or patient\n");
+	printf("  -geometry <g>         Feature geometry: 44k (default), 48k or 22k; a\n");
+	printf("                        -learnFile selects it from its header\n");
+	printf("  -quantize <bits>      Match files against 8 or 16-bit learning features\n");
+	printf("  -threads <n>          Classification threads (default: one per CPU)\n");
+	printf("  -top <k>              Report the k best matches of every segment\n");
+	printf("  -perspecies           Report the best match of every species per segment\n");
+	printf("  -ann <n>              Compare segments only with the n learning samples of\n");
+	printf("                        nearest mean spectrum (approximate); with -crosstest\n");
+	printf("                        report its recall against the exact search\n");
+	printf("  -benchmark            Time double and float feature extraction and exit\n\n");
 	printf("Tuning parameters:\n");
 	printf("  -snr <value>          Signal-to-Noise Ratio threshold (default: 3.0)\n");
 	printf("  -cutoff <value>       Difference cutoff threshold (default: 0.255)\n");
@@ -438,6 +980,10 @@ int main_detect(int argc, char *argv[]){
 	char * save = NULL;
 	const char * dirName = "samples/";
 	char * learnFile = NULL;
+	char * wisdomFile = NULL;
+	const SGeometryInfo* geometry = &defaultGeometry();
+	int quantizeBits = 0;
+	bool benchmark = false;
 	vector<char*> filenames;
 	for (int i = 1; i<argc; ++i){
 		if (strcmp(argv[i], "-cutoff") == 0){
@@ -498,6 +1044,119 @@ int main_detect(int argc, char *argv[]){
 			printUnknown = false;
 		} else if (strcmp(argv[i], "-crosstest") == 0){
 			crosstest = true;
+		} else if (strcmp(argv[i], "-wisdom") == 0){
+			if (++i == argc){
+				printf("No filename!\n");
+				return 1;
+			}
+			wisdomFile = argv[i];
+		} else if (strcmp(argv[i], "-planner") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			if (strcmp(argv[i], "estimate") == 0){
+				CFFTPlanCache::getInstance().setPlannerFlags(FFTW_ESTIMATE);
+			} else if (strcmp(argv[i], "measure") == 0){
+				CFFTPlanCache::getInstance().setPlannerFlags(FFTW_MEASURE);
+			} else if (strcmp(argv[i], "patient") == 0){
+				CFFTPlanCache::getInstance().setPlannerFlags(FFTW_PATIENT);
+			} else {
+				printf("Unknown planner: %s\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-geometry") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			geometry = findGeometry(argv[i]);
+			if (geometry == NULL){
+				printf("Unknown geometry: %s\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-quantize") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			quantizeBits = atoi(argv[i]);
+			if (quantizeBits != 8 && quantizeBits != 16){
+				printf("Quantization must be 8 or 16 bits: %s\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-threads") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			int threads = atoi(argv[i]);
+			if (threads < 1){
+				printf("Thread count must be positive: %s\n", argv[i]);
+				return 1;
+			}
+			threadCount = threads;
+		} else if (strcmp(argv[i], "-top") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			int k = atoi(argv[i]);
+			if (k < 1){
+				printf("Match count must be positive: %s\n", argv[i]);
+				return 1;
+			}
+			topMatches = k;
+		} else if (strcmp(argv[i], "-crossvalidate") == 0){
+			crossvalidate = true;
+		} else if (strcmp(argv[i], "-distcache") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			distanceCache = argv[i];
+		} else if (strcmp(argv[i], "-condense") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			condenseFile = argv[i];
+		} else if (strcmp(argv[i], "-seed") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			crossTestSeed = strtoul(argv[i], NULL, 10);
+		} else if (strcmp(argv[i], "-ann") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			int n = atoi(argv[i]);
+			if (n < 1){
+				printf("Candidate count must be positive: %s\n", argv[i]);
+				return 1;
+			}
+			annCandidates = n;
+		} else if (strcmp(argv[i], "-perspecies") == 0){
+			perSpecies = true;
+		} else if (strcmp(argv[i], "-benchmark") == 0){
+			benchmark = true;
+		} else if (strcmp(argv[i], "-compareprecision") == 0){
+			compareprecision = true;
+		} else if (strcmp(argv[i], "-precision") == 0){
+			if (++i == argc){
+				printf("No value!\n");
+				return 1;
+			}
+			if (strcmp(argv[i], "float") == 0){
+				fft.setPrecision(FFT_FLOAT);
+			} else if (strcmp(argv[i], "double") == 0){
+				fft.setPrecision(FFT_DOUBLE);
+			} else {
+				printf("Unknown precision: %s\n", argv[i]);
+				return 1;
+			}
 		} else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0){
 			print_help(argv[0]);
 			return 5;
@@ -508,26 +1167,109 @@ int main_detect(int argc, char *argv[]){
 			filenames.push_back(argv[i]);
 		}
 	}	
+	if (wisdomFile){
+		if (!CFFTPlanCache::getInstance().importWisdom(wisdomFile) && verbose){
+			printf("No FFTW wisdom read from %s\n", wisdomFile);
+		}
+	}
+	if (benchmark){
+		benchmarkEngines();
+		return 0;
+	}
 	vector<unique_ptr<CSample>> learning;
+	unique_ptr<CFeatureModel> model;	//learning set in a non-default geometry
 	if (learnFile){
-		learning = readLearningFromFile(learnFile);
+		const SGeometryInfo* fileGeometry = readLearningGeometry(learnFile);
+		if (fileGeometry != NULL && fileGeometry != &defaultGeometry()){
+			model = CFeatureModel::load(learnFile);
+			if (!model){
+				return 1;
+			}
+		} else {
+			learning = readLearningFromFile(learnFile);
+		}
 	} else {
 		if (saveLearning){
 			manager.setSavePrefix(saveLearning);
 		}
 		learning = readLearning(dirName, manager);
+		if (geometry != &defaultGeometry()){
+			model = make_unique<CFeatureModel>(*geometry);
+			model->addSamples(toRawSamples(learning));
+			if (verbose){
+				printf("%d samples in %s learning model\n", (int)model->getSamples().size(), geometry->name);
+			}
+		}
 		if (saveLearning){
-			auto learningRaw = toRawSamples(learning);
-			saveSamplesToFile(learningRaw, "learning-all.freq");
+			if (model){
+				model->save("learning-all.freq");
+			} else {
+				auto learningRaw = toRawSamples(learning);
+				saveSamplesToFile(learningRaw, "learning-all.freq");
+			}
 		}
 	}
 	manager.setSavePrefix("");
 	auto learningRaw = toRawSamples(learning);
-	if (crosstest){
+	if (crosstest && compareprecision){
+		if (learnFile){
+			printf("Precision comparison needs a learning directory, not -learnFile\n");
+		} else {
+			comparePrecision(dirName, manager, fft);
+		}
+	}
+	if (crossvalidate && model){
+		printf("Cross-validation is only available with %s features\n", defaultGeometry().name);
+	} else if (crossvalidate){
+		crossTest(learningRaw);
+	}
+	if (condenseFile && model){
+		printf("Condensation is only available with %s features\n", defaultGeometry().name);
+	} else if (condenseFile){
+		condenseLearning(learningRaw, condenseFile);
+	}
+	if (crosstest && model){
+		printf("Cross test is only available with %s features\n", defaultGeometry().name);
+	} else if (crosstest){
 		// crossTest(learning);
 		auto learn = readLearningFromFile("categories.freq");
 		auto learnRaw = toRawSamples(learn);
 		test(learningRaw, learnRaw);
+		if (annCandidates > 0){
+			annRecall(learningRaw, learnRaw);
+		}
+	}
+	TQuantizedSet<uint8_t> learning8;
+	TQuantizedSet<uint16_t> learning16;
+	if ((topMatches > 0 || perSpecies) && (model || quantizeBits != 0)){
+		printf("Multiple matches are only reported for the full %s learning set\n", defaultGeometry().name);
+	}
+	if (quantizeBits != 0 && model){
+		printf("Quantized features are only available with %s features\n", defaultGeometry().name);
+		quantizeBits = 0;
+	} else if (quantizeBits == 8){
+		learning8.add(learningRaw);
+	} else if (quantizeBits == 16){
+		learning16.add(learningRaw);
+	}
+	CLearningMatrix learningMatrix;
+	if (quantizeBits != 0){
+		//only the quantized copy is needed from here on
+		learningRaw.clear();
+		learning.clear();
+	} else if (!model && filenames.size() > 0){
+		learningMatrix.add(learningRaw);
+		if (verbose){
+			printf("Learning matrix: %zu samples, %zu bytes\n", learningMatrix.size(), learningMatrix.memoryBytes());
+		}
+	}
+	unique_ptr<CVPTree> index;
+	if (annCandidates > 0 && learningMatrix.size() > 0){
+		index = make_unique<CVPTree>(learningMatrix);
+	}
+	if (verbose && quantizeBits != 0){
+		size_t bytes = quantizeBits == 8 ? learning8.memoryBytes() : learning16.memoryBytes();
+		printf("Quantized learning set: %zu bytes\n", bytes);
 	}
 	if (filenames.size() > 0) {
 		if (save){
@@ -537,7 +1279,25 @@ int main_detect(int argc, char *argv[]){
 			printf("Got %d files to analyze\n", (int)filenames.size());
 		}
 		for (vector<char*>::iterator it = filenames.begin(); it != filenames.end(); ++it){
-			analyzeDarlowo(*it, learningRaw, manager);
+			if (model){
+				analyzeWithModel(*it, *model, manager);
+			} else if (quantizeBits == 8){
+				analyzeQuantized(*it, learning8, manager);
+			} else if (quantizeBits == 16){
+				analyzeQuantized(*it, learning16, manager);
+			} else {
+				analyzeDarlowo(*it, learningMatrix, manager, index.get());
+			}
+		}
+	}
+	SPruningStats& pruning = SPruningStats::getInstance();
+	if (verbose && pruning.candidates > 0){
+		printf("Lower bound pruned %llu of %llu candidates (%3.2f%%)\n", pruning.pruned.load(), pruning.candidates.load(), 100.0*pruning.pruned/pruning.candidates);
+		printf("Frame count skipped %llu of %llu candidates (%3.2f%%)\n", pruning.lengthSkipped.load(), pruning.candidates.load(), 100.0*pruning.lengthSkipped/pruning.candidates);
+	}
+	if (wisdomFile){
+		if (!CFFTPlanCache::getInstance().exportWisdom(wisdomFile)){
+			fprintf(stderr, "Unable to save FFTW wisdom to %s\n", wisdomFile);
 		}
 	}
 	return 0;
@@ -41,11 +41,20 @@ inline void Dprintf(const char* fmt, ...) {
 #endif
 
 class CManager;
+class CLearningMatrix;
+class CDistanceMatrix;
+class CThreadPool;
 
 void test(std::vector<CSample*>& samples, std::vector<CSample*>& learning);
 CSample * test(CSample * tested, std::vector<CSample*>& learning, bool print = true);
-std::vector<std::unique_ptr<CSample>> categorize(std::vector<CSample*>& samples, double delta);
+CSample * test(CSample * tested, const CLearningMatrix& learning, bool print = true);
+std::vector<std::unique_ptr<CSample>> categorize(std::vector<CSample*>& samples, double delta, CThreadPool* pool = nullptr);
+// Indices of a small subset of samples whose nearest neighbours still
+// recognize the rest (below cutoff, same species): mislabeled samples are
+// edited out first and counted in edited
+std::vector<size_t> condense(const std::vector<CSample*>& samples, const CDistanceMatrix& distances, double cutoff, CThreadPool* pool = nullptr, size_t* edited = nullptr);
 void analyze(std::vector<CSample*>& samples, std::vector<CSample*>& learning);
+void analyze(std::vector<CSample*>& samples, const CLearningMatrix& learning);
 #ifdef QT_CORE_LIB
 std::vector<std::unique_ptr<CSample>> readLearning(const char* dirName, CManager& manager, QProgressBar* progress = NULL);
 #else
@@ -12,9 +12,19 @@
 #include <cmath>
 #include <vector>
 #include <memory>
+#include <random>
+#include <thread>
 #include "detect/Audio.hxx"
+#include "detect/DistanceMatrix.hxx"
 #include "detect/Manager.hxx"
+#include "detect/Quantized.hxx"
 #include "detect/detect.hxx"
+#include "detect/Geometry.hxx"
+#include "detect/LearningMatrix.hxx"
+#include "detect/Simd.hxx"
+#include "detect/Spectral.hxx"
+#include "detect/ThreadPool.hxx"
+#include "detect/VPTree.hxx"
 
 namespace {
 std::unique_ptr<CSample> makeSample(uint birdId, uint sampleId, const std::string& name, double value) {
@@ -901,3 +911,1176 @@ TEST_F(AudioTest, CSampleNoFrequencyMemoryLeaks) {
     // If we get here without crashes, RAII is working
     SUCCEED();
 }
+
+// ============================================================================
+// Batched STFT Tests
+// ============================================================================
+
+namespace {
+std::vector<double> makeChirp(size_t n) {
+    std::vector<double> signal(n);
+    for (size_t i = 0; i < n; ++i) {
+        signal[i] = std::sin(2.0 * PI * (0.02 + 0.00002 * i) * i) + 0.1 * std::cos(0.3 * i);
+    }
+    return signal;
+}
+}
+
+TEST_F(AudioTest, BatchedFramesMatchSingleFrameCompute) {
+    // More frames than one batch, with a partial batch at the end
+    const int count = STFT_BATCH * 2 + 5;
+    std::vector<double> signal = makeChirp(FFT_SIZE + (count - 1) * SEGMENT_FRAMES);
+    CFFT fft;
+
+    std::vector<SFrequencies> batched(count);
+    std::vector<OrigFrequencies> batchedOrig(count);
+    fft.computeFrames(signal.data(), count, batched.data(), batchedOrig.data());
+
+    for (int f = 0; f < count; ++f) {
+        SFrequencies single;
+        OrigFrequencies singleOrig;
+        singleOrig.minValue = DOUBLE_BIG;
+        singleOrig.maxValue = -DOUBLE_BIG;
+        fft.compute(signal.data() + f * SEGMENT_FRAMES, single, singleOrig);
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            EXPECT_NEAR(batched[f].freq[i], single.freq[i], 1e-9 * (1.0 + single.freq[i]))
+                << "frame " << f << " bin " << i;
+        }
+        for (uint i = 0; i < FFT_SIZE; ++i) {
+            EXPECT_NEAR(batchedOrig[f].freq[i], singleOrig.freq[i], 1e-9 * (1.0 + singleOrig.freq[i]));
+        }
+        EXPECT_NEAR(batchedOrig[f].maxValue, singleOrig.maxValue, 1e-9 * singleOrig.maxValue);
+        EXPECT_NEAR(batchedOrig[f].minValue, singleOrig.minValue, 1e-9 * (1.0 + singleOrig.minValue));
+    }
+}
+
+TEST_F(AudioTest, ComputeFrequenciesFrameCount) {
+    const int n = 3000;
+    std::vector<double> signal = makeChirp(n);
+    std::vector<SFrequencies> freqs;
+    std::vector<OrigFrequencies> orig;
+
+    computeFrequencies(signal.data(), freqs, orig, n);
+
+    const size_t expected = (n - FFT_SIZE) / SEGMENT_FRAMES + 1;
+    EXPECT_EQ(freqs.size(), expected);
+    EXPECT_EQ(orig.size(), expected);
+}
+
+// ============================================================================
+// Single Precision Pipeline Tests
+// ============================================================================
+
+TEST_F(AudioTest, CFftPrecisionSelectable) {
+    CFFT fft;
+    EXPECT_EQ(fft.getPrecision(), FFT_DOUBLE);
+    fft.setPrecision(FFT_FLOAT);
+    EXPECT_EQ(fft.getPrecision(), FFT_FLOAT);
+}
+
+TEST_F(AudioTest, FloatFramesCloseToDouble) {
+    const int count = STFT_BATCH + 3;
+    std::vector<double> signal = makeChirp(FFT_SIZE + (count - 1) * SEGMENT_FRAMES);
+    CFFT doubleFft(FFT_DOUBLE);
+    CFFT floatFft(FFT_FLOAT);
+
+    std::vector<SFrequencies> d(count);
+    std::vector<SFrequencies> f(count);
+    doubleFft.computeFrames(signal.data(), count, d.data());
+    floatFft.computeFrames(signal.data(), count, f.data());
+
+    for (int i = 0; i < count; ++i) {
+        double peak = 0;
+        for (uint j = 0; j < COUNT_FREQ; ++j) {
+            peak = std::max(peak, (double)d[i].freq[j]);
+        }
+        for (uint j = 0; j < COUNT_FREQ; ++j) {
+            EXPECT_NEAR(f[i].freq[j], d[i].freq[j], 1e-5 * peak)
+                << "frame " << i << " bin " << j;
+        }
+    }
+}
+
+// ============================================================================
+// FFTW Plan Cache Tests
+// ============================================================================
+
+TEST_F(AudioTest, PlanCacheReusesPlans) {
+    CFFTPlanCache& cache = CFFTPlanCache::getInstance();
+    fftw_plan first = cache.getPlan<double>(FFT_SIZE, 3);
+    size_t size = cache.size();
+    fftw_plan second = cache.getPlan<double>(FFT_SIZE, 3);
+
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(cache.size(), size) << "Repeated lookups must not create plans";
+    EXPECT_NE((void*)cache.getPlan<float>(FFT_SIZE, 3), nullptr);
+}
+
+TEST_F(AudioTest, PlanCacheSharedByInstances) {
+    std::vector<double> signal = makeChirp(FFT_SIZE + 4 * SEGMENT_FRAMES);
+    std::vector<SFrequencies> a(5);
+    std::vector<SFrequencies> b(5);
+    {
+        CFFT fft;
+        fft.computeFrames(signal.data(), 5, a.data());
+    }
+    size_t size = CFFTPlanCache::getInstance().size();
+    CFFT fft;
+    fft.computeFrames(signal.data(), 5, b.data());
+
+    EXPECT_EQ(CFFTPlanCache::getInstance().size(), size);
+    for (uint i = 0; i < COUNT_FREQ; ++i) {
+        EXPECT_DOUBLE_EQ(a[4].freq[i], b[4].freq[i]);
+    }
+}
+
+TEST_F(AudioTest, PlanCacheMeasuredPlansMatchEstimate) {
+    std::vector<double> signal = makeChirp(FFT_SIZE + 6 * SEGMENT_FRAMES);
+    std::vector<SFrequencies> estimated(7);
+    std::vector<SFrequencies> measured(7);
+    CFFTPlanCache& cache = CFFTPlanCache::getInstance();
+    CFFT fft;
+
+    fft.computeFrames(signal.data(), 7, estimated.data());
+    cache.setPlannerFlags(FFTW_MEASURE);
+    fft.computeFrames(signal.data(), 7, measured.data());
+    cache.setPlannerFlags(FFTW_ESTIMATE);
+
+    for (int f = 0; f < 7; ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            EXPECT_NEAR(measured[f].freq[i], estimated[f].freq[i], 1e-9 * (1.0 + estimated[f].freq[i]));
+        }
+    }
+}
+
+TEST_F(AudioTest, PlanCacheExportsWisdom) {
+    const std::string filename = ::testing::TempDir() + "bsc_test.wisdom";
+    std::remove(filename.c_str());
+    std::remove((filename + ".float").c_str());
+
+    EXPECT_TRUE(CFFTPlanCache::getInstance().exportWisdom(filename));
+    EXPECT_TRUE(CFFTPlanCache::getInstance().importWisdom(filename));
+
+    std::remove(filename.c_str());
+    std::remove((filename + ".float").c_str());
+}
+
+// ============================================================================
+// Window Table Tests
+// ============================================================================
+
+static_assert(HANNING_WINDOW[0] == 0.0, "Hanning window table must be built at compile time");
+
+TEST_F(AudioTest, ConstexprHanningMatchesWindowFunction) {
+    double ones[FFT_SIZE];
+    double window[FFT_SIZE];
+    for (uint i = 0; i < FFT_SIZE; ++i) {
+        ones[i] = 1.0;
+    }
+    HanningWindow(ones, window, FFT_SIZE);
+
+    for (uint i = 0; i < FFT_SIZE; ++i) {
+        EXPECT_NEAR(HANNING_WINDOW[i], window[i], 1e-14) << "at " << i;
+    }
+}
+
+TEST_F(AudioTest, ConcurrentExtractionMatchesSerial) {
+    const int count = 2 * STFT_BATCH + 1;
+    std::vector<double> signal = makeChirp(FFT_SIZE + (count - 1) * SEGMENT_FRAMES);
+    std::vector<SFrequencies> expected(count);
+    {
+        CFFT fft;
+        fft.computeFrames(signal.data(), count, expected.data());
+    }
+
+    const int threadCount = 4;
+    std::vector<std::vector<SFrequencies>> results(threadCount, std::vector<SFrequencies>(count));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t]() {
+            CFFT fft;
+            for (int repeat = 0; repeat < 5; ++repeat) {
+                fft.computeFrames(signal.data(), count, results[t].data());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < threadCount; ++t) {
+        for (int f = 0; f < count; ++f) {
+            for (uint i = 0; i < COUNT_FREQ; ++i) {
+                ASSERT_EQ(results[t][f].freq[i], expected[f].freq[i]);
+            }
+        }
+    }
+}
+
+// ============================================================================
+// Lazy OrigFrequencies Tests
+// ============================================================================
+
+TEST_F(AudioTest, OrigFrequenciesComputedOnDemand) {
+    SnrMinGuard snrGuard(0.0);
+    const int n = 3000;
+    std::vector<double> signal = makeChirp(n);
+    CFFT fft;
+    CSample sample(signal.data(), n, 44100, 1, 0, n, 1, &fft);
+
+    std::vector<SFrequencies> freqs;
+    std::vector<OrigFrequencies> expected;
+    computeFrequencies(fft, signal.data(), freqs, expected, n);
+
+    const std::vector<OrigFrequencies>& orig = sample.getOrigFrequencies();
+    ASSERT_EQ(orig.size(), sample.getFreqCount());
+    ASSERT_EQ(orig.size(), expected.size());
+    for (size_t f = 0; f < orig.size(); ++f) {
+        for (uint i = 0; i < FFT_SIZE; ++i) {
+            EXPECT_DOUBLE_EQ(orig[f].freq[i], expected[f].freq[i]);
+        }
+        EXPECT_DOUBLE_EQ(orig[f].maxValue, expected[f].maxValue);
+    }
+}
+
+TEST_F(AudioTest, OrigFrequenciesEmptyWithoutFrames) {
+    auto sample = makeSample(1, 1, "TEST", 0.5);
+    EXPECT_TRUE(sample->getOrigFrequencies().empty());
+}
+
+// ============================================================================
+// Vectorized Normalize Tests
+// ============================================================================
+
+TEST_F(AudioTest, FastLogMatchesStdLog) {
+    typedef SVec<double> V;
+    typedef SScalar<double> S;
+    double in[V::width];
+    double out[V::width];
+    double worst = 0;
+    for (double x = 1e-30; x < 1e30; x *= 1.37) {
+        for (int k = 0; k < V::width; ++k) {
+            in[k] = x * (1 + 0.1 * k);
+        }
+        V::store(out, fastLog<V, double>(V::load(in)));
+        for (int k = 0; k < V::width; ++k) {
+            worst = std::max(worst, std::fabs(out[k] - std::log(in[k])));
+        }
+        worst = std::max(worst, std::fabs(fastLog<S, double>(x) - std::log(x)));
+    }
+    EXPECT_LT(worst, 1e-12);
+    double logZero = fastLog<S, double>(0.0);
+    EXPECT_TRUE(std::isinf(logZero));
+    EXPECT_LT(logZero, 0.0);
+}
+
+TEST_F(AudioTest, NormalizeMatchesScalarReference) {
+    SnrMinGuard snrGuard(0.0);
+    const int n = 5000;
+    std::vector<double> signal = makeChirp(n);
+    CFFT fft;
+    CSample sample(signal.data(), n, 44100, 1, 0, n, 1, &fft);
+
+    // The pre-vectorization normalize, with std::log
+    std::vector<SFrequencies> expected;
+    computeFrequencies(fft, signal.data(), expected, n);
+    double maximum = -100000;
+    double minAvg = 100000;
+    for (auto& f : expected) {
+        double avg = 0;
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            f.freq[i] = std::log(f.freq[i]);
+            avg += f.freq[i];
+            maximum = std::max(maximum, (double)f.freq[i]);
+        }
+        minAvg = std::min(minAvg, avg);
+    }
+    double minimum = (minAvg / COUNT_FREQ + maximum) / 2;
+
+    const std::vector<SFrequencies>& actual = sample.getFrequencies();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t f = 0; f < actual.size(); ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            double ref = std::max(0.0, (expected[f].freq[i] - minimum) / (maximum - minimum));
+            EXPECT_NEAR(actual[f].freq[i], ref, sizeof(freq_t) == sizeof(float) ? 1e-5 : 1e-10);
+            EXPECT_GE(actual[f].freq[i], 0.0);
+            EXPECT_LE(actual[f].freq[i], 1.0);
+        }
+    }
+}
+
+// ============================================================================
+// Feature Geometry Tests
+// ============================================================================
+
+TEST_F(AudioTest, DefaultGeometryMatchesCSample) {
+    SnrMinGuard snrGuard(0.0);
+    const int n = 4000;
+    std::vector<double> signal = makeChirp(n);
+    CFFT fft;
+    CSample sample(signal.data(), n, 44100, 1, 0, n, 1, &fft);
+
+    std::vector<freq_t> features;
+    TFeatureExtractor<DefaultGeometry>::extract(signal.data(), n, features);
+
+    ASSERT_EQ(features.size(), sample.getFreqCount() * COUNT_FREQ);
+    for (size_t f = 0; f < sample.getFreqCount(); ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            EXPECT_NEAR(features[f * COUNT_FREQ + i], sample.getFrequencies()[f].freq[i], 1e-5);
+        }
+    }
+}
+
+TEST_F(AudioTest, DifferRowsMatchesCSampleDiffer) {
+    std::vector<freq_t> rowsA(10 * COUNT_FREQ), rowsB(14 * COUNT_FREQ);
+    for (size_t i = 0; i < rowsA.size(); ++i) {
+        rowsA[i] = (i % 7) / 7.0;
+    }
+    for (size_t i = 0; i < rowsB.size(); ++i) {
+        rowsB[i] = (i % 5) / 5.0;
+    }
+    auto framesA = std::make_unique<SFrequencies[]>(10);
+    auto framesB = std::make_unique<SFrequencies[]>(14);
+    for (size_t i = 0; i < rowsA.size(); ++i) {
+        framesA[i / COUNT_FREQ].freq[i % COUNT_FREQ] = rowsA[i];
+    }
+    for (size_t i = 0; i < rowsB.size(); ++i) {
+        framesB[i / COUNT_FREQ].freq[i % COUNT_FREQ] = rowsB[i];
+    }
+    CSample a(framesA.release(), 10, 1, 1);
+    CSample b(framesB.release(), 14, 1, 2);
+
+    double full = differRows<COUNT_FREQ>(rowsA.data(), 10, rowsB.data(), 14);
+    EXPECT_DOUBLE_EQ(full, a.differ(b));
+    EXPECT_DOUBLE_EQ(differRows<COUNT_FREQ>(rowsA.data(), 10, rowsB.data(), 4), 1.2);
+    EXPECT_DOUBLE_EQ(differRows<COUNT_FREQ>(rowsA.data(), 10, rowsB.data(), 14, 2 * full), full);
+    EXPECT_GE(differRows<COUNT_FREQ>(rowsA.data(), 10, rowsB.data(), 14, full / 2), full / 2);
+}
+
+TEST_F(AudioTest, FeatureExtractorPerThreadMatchesSerial) {
+    const int n = 6000;
+    std::vector<double> signal = makeChirp(n);
+    std::vector<freq_t> expected;
+    TFeatureExtractor<Geometry48k>::extract(signal.data(), n, expected);
+    std::vector<std::vector<freq_t>> features(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < features.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            TFeatureExtractor<Geometry48k>::extract(signal.data(), n, features[t]);
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (const std::vector<freq_t>& f : features) {
+        EXPECT_EQ(f, expected);
+    }
+}
+
+TEST_F(AudioTest, GeometryRegistryLookups) {
+    const SGeometryInfo& def = defaultGeometry();
+    EXPECT_EQ(def.fftSize, FFT_SIZE);
+    EXPECT_EQ(def.countFreq, COUNT_FREQ);
+    EXPECT_EQ(findGeometry(FFT_SIZE, FIRST_FREQ, LAST_FREQ), &def);
+    ASSERT_NE(findGeometry("48k"), nullptr);
+    EXPECT_EQ(findGeometry("48k")->sampleRate, 48000u);
+    EXPECT_EQ(findGeometry("nope"), nullptr);
+    EXPECT_EQ(findGeometry(1000, 1, 2), nullptr);
+}
+
+TEST_F(AudioTest, FeatureModelRoundTripInOtherGeometry) {
+    SnrMinGuard snrGuard(0.0);
+    const SGeometryInfo* geometry = findGeometry("48k");
+    ASSERT_NE(geometry, nullptr);
+    const int n = 6000;
+    std::vector<double> chirp = makeChirp(n);
+    std::vector<double> tone(n);
+    for (int i = 0; i < n; ++i) {
+        tone[i] = std::sin(0.9 * i);
+    }
+    CFeatureModel model(*geometry);
+    ASSERT_TRUE(model.addSignal(chirp.data(), n, 1, 1));
+    ASSERT_TRUE(model.addSignal(tone.data(), n, 2, 2));
+    EXPECT_EQ(model.getSamples()[0].frames, (size_t)TFeatureExtractor<Geometry48k>::frameCount(n));
+
+    const std::string filename = ::testing::TempDir() + "bsc_test_48k.freq";
+    ASSERT_TRUE(model.save(filename.c_str()));
+    EXPECT_EQ(readLearningGeometry(filename.c_str()), geometry);
+    EXPECT_TRUE(readLearningFromFile(filename.c_str()).empty());
+    auto loaded = CFeatureModel::load(filename.c_str());
+    std::remove(filename.c_str());
+
+    ASSERT_TRUE(loaded != nullptr);
+    EXPECT_EQ(&loaded->getGeometry(), geometry);
+    ASSERT_EQ(loaded->getSamples().size(), 2u);
+    double diff = 0;
+    const SModelSample* match = loaded->classify(tone.data(), n, 1.0, &diff);
+    ASSERT_NE(match, nullptr);
+    EXPECT_EQ(match->birdId, 2u);
+    EXPECT_LT(diff, 1e-6);
+}
+
+// ============================================================================
+// Streaming STFT Tests
+// ============================================================================
+
+TEST_F(AudioTest, StreamingSTFTMatchesWholeSignal) {
+    const int n = 9000;
+    std::vector<double> signal = makeChirp(n);
+    CFFT fft;
+    std::vector<SFrequencies> expected;
+    computeFrequencies(fft, signal.data(), expected, n);
+
+    CStreamingSTFT stft(fft);
+    const size_t blocks[] = {1, 7, 333, 8, 4096};
+    size_t pos = 0;
+    for (int b = 0; pos < signal.size(); b = (b + 1) % 5) {
+        size_t take = std::min(blocks[b], signal.size() - pos);
+        stft.push(signal.data() + pos, take);
+        pos += take;
+    }
+    stft.flush();
+
+    EXPECT_EQ(stft.getSampleCount(), (size_t)n);
+    const std::vector<SFrequencies>& actual = stft.getFrequencies();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t f = 0; f < actual.size(); ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            EXPECT_NEAR(actual[f].freq[i], expected[f].freq[i], 1e-9 * (1.0 + expected[f].freq[i]));
+        }
+    }
+
+    stft.reset();
+    EXPECT_TRUE(stft.getFrequencies().empty());
+    EXPECT_EQ(stft.getSampleCount(), 0u);
+}
+
+TEST_F(AudioTest, CManagerSampleFeaturesMatchItsFrames) {
+    SnrMinGuard snrGuard(0.0);
+    CFFT fft;
+    CManager manager(fft);
+    manager.setPowerCutoff(1e-3);
+
+    std::vector<double> frames(1000, 0.0);
+    std::vector<double> chirp = makeChirp(6000);
+    frames.insert(frames.end(), chirp.begin(), chirp.end());
+    frames.resize(frames.size() + 1000, 0.0);
+    auto memoryFile = std::make_unique<CMemoryFile>(frames.data(), frames.size(), 44100, "memory");
+    manager.setFile(std::move(memoryFile));
+
+    std::unique_ptr<CSample> sample(manager.getSample());
+    ASSERT_NE(sample, nullptr);
+    std::vector<double> copy = sample->getFrames();
+    CSample direct(copy.data(), copy.size(), 44100, 1, 0, 0, 0, &fft);
+    ASSERT_EQ(sample->getFreqCount(), direct.getFreqCount());
+    for (size_t f = 0; f < direct.getFreqCount(); ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            EXPECT_NEAR(sample->getFrequencies()[f].freq[i], direct.getFrequencies()[f].freq[i], 1e-9);
+        }
+    }
+}
+
+// ============================================================================
+// Quantized Feature Tests
+// ============================================================================
+
+namespace {
+std::unique_ptr<CSample> makeRampSample(uint birdId, uint sampleId, size_t frames, double phase) {
+    auto frequencies = std::make_unique<SFrequencies[]>(frames);
+    for (size_t f = 0; f < frames; ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            double x = 0.5 + 0.5 * std::sin(phase + 0.37 * i + 0.11 * f);
+            frequencies[f].freq[i] = x < 0.1 ? 0.0 : x;
+        }
+    }
+    return std::make_unique<CSample>(frequencies.release(), frames, birdId, sampleId);
+}
+}
+
+TEST_F(AudioTest, QuantizedDifferMatchesFloatDiffer) {
+    auto a = makeRampSample(1, 1, 20, 0.0);
+    auto b = makeRampSample(2, 2, 24, 1.3);
+    double exact = a->differ(*b);
+
+    TQuantizedSet<uint8_t> set8;
+    TQuantizedSet<uint16_t> set16;
+    set8.add(*b);
+    set16.add(*b);
+    std::vector<uint8_t> q8 = TQuantizedSet<uint8_t>::quantize(*a);
+    std::vector<uint16_t> q16 = TQuantizedSet<uint16_t>::quantize(*a);
+
+    EXPECT_NEAR(set8.differ(q8, a->getFreqCount(), 0), exact, 5e-3);
+    EXPECT_NEAR(set16.differ(q16, a->getFreqCount(), 0), exact, 5e-5);
+}
+
+TEST_F(AudioTest, QuantizedSetFindsSameNearestSample) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    for (uint i = 0; i < 12; ++i) {
+        learning.push_back(makeRampSample(1 + i % 4, i + 1, 16 + i, 0.4 * i));
+    }
+    TQuantizedSet<uint8_t> set8;
+    for (const auto& s : learning) {
+        set8.add(*s);
+    }
+    EXPECT_EQ(set8.size(), learning.size());
+    EXPECT_LT(set8.memoryBytes(), learning.size() * 27 * sizeof(SFrequencies) / 4);
+
+    for (uint t = 0; t < 6; ++t) {
+        auto tested = makeRampSample(0, 100 + t, 18, 0.4 * t * 2 + 0.05);
+        size_t best = 0;
+        for (size_t j = 1; j < learning.size(); ++j) {
+            if (tested->differ(*learning[j]) < tested->differ(*learning[best])) {
+                best = j;
+            }
+        }
+        double diff = 0;
+        int found = set8.nearest(*tested, 100.0, &diff);
+        ASSERT_GE(found, 0);
+        EXPECT_EQ(set8.getId(found), learning[best]->getId());
+        EXPECT_NEAR(diff, tested->differ(*learning[best]), 5e-3);
+    }
+}
+
+// ============================================================================
+// Branchless Differ Tests
+// ============================================================================
+
+TEST_F(AudioTest, DifferBinsMatchesScalarReference) {
+    std::mt19937 g(7);
+    std::uniform_real_distribution<double> value(0.0, 1.0);
+    const double tolerance = sizeof(freq_t) == sizeof(float) ? 1e-6 : 1e-14;
+    for (int trial = 0; trial < 200; ++trial) {
+        SFrequencies a, b;
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            // A third of the bins silent, some of them in both frames
+            a.freq[i] = value(g) < 0.33 ? 0 : value(g);
+            b.freq[i] = value(g) < 0.33 ? 0 : value(g);
+        }
+        double expected = differBinsScalar<COUNT_FREQ>(a.freq, b.freq);
+        EXPECT_NEAR(a.differ(b), expected, tolerance * (1.0 + std::fabs(expected)));
+    }
+}
+
+TEST_F(AudioTest, DifferBinsOfSilentFramesIsNaN) {
+    SFrequencies a, b;
+    for (uint i = 0; i < COUNT_FREQ; ++i) {
+        a.freq[i] = b.freq[i] = 0;
+    }
+    EXPECT_TRUE(std::isnan(differBinsScalar<COUNT_FREQ>(a.freq, b.freq)));
+    EXPECT_TRUE(std::isnan(a.differ(b)));
+}
+
+// ============================================================================
+// Prepared Differ Tests
+// ============================================================================
+
+TEST_F(AudioTest, PreparedDifferMatchesDivision) {
+    auto a = makeRampSample(1, 1, 20, 0.0);
+    auto b = makeRampSample(2, 2, 24, 1.3);
+    double expected = a->differ(*b);
+
+    b->prepare();
+    EXPECT_TRUE(b->isPrepared());
+    EXPECT_FALSE(a->isPrepared());
+    double prepared = a->differ(*b);
+    EXPECT_TRUE(a->isPrepared()) << "The query side is prepared on first use";
+    EXPECT_NEAR(prepared, expected, (sizeof(freq_t) == sizeof(float) ? 1e-6 : 1e-14) * (1.0 + expected));
+
+    CSample copy(*b);
+    EXPECT_TRUE(copy.isPrepared());
+    EXPECT_DOUBLE_EQ(a->differ(copy), prepared);
+}
+
+TEST_F(AudioTest, PreparedFramesHoldPlusOneAndReciprocal) {
+    SFrequencies f;
+    for (uint i = 0; i < COUNT_FREQ; ++i) {
+        f.freq[i] = i / (double)COUNT_FREQ;
+    }
+    SPreparedFrequencies p(f);
+    for (uint i = 0; i < COUNT_FREQ; ++i) {
+        EXPECT_FLOAT_EQ(p.plus1[i], f.freq[i] + 1);
+        EXPECT_FLOAT_EQ(p.reciprocal[i] * p.plus1[i], 1);
+    }
+    EXPECT_NEAR(p.differ(p), 0.0, 1e-6);
+}
+
+// ============================================================================
+// Early Abandon Tests
+// ============================================================================
+
+TEST_F(AudioTest, BoundedDifferKeepsNearestNeighbour) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    for (uint i = 0; i < 20; ++i) {
+        learning.push_back(makeRampSample(1 + i % 4, i + 1, 16 + i % 5, 0.3 * i));
+    }
+    for (bool prepared : {false, true}) {
+        if (prepared) {
+            for (auto& s : learning) {
+                s->prepare();
+            }
+        }
+        for (uint t = 0; t < 5; ++t) {
+            auto tested = makeRampSample(0, 100 + t, 18, 0.7 * t + 0.1);
+            double exactBest = 100, boundedBest = 100;
+            size_t exactIdx = 0, boundedIdx = 0;
+            for (size_t j = 0; j < learning.size(); ++j) {
+                double exact = tested->differ(*learning[j]);
+                double bounded = tested->differ(*learning[j], boundedBest);
+                if (bounded < boundedBest) {
+                    EXPECT_DOUBLE_EQ(bounded, exact);
+                } else {
+                    EXPECT_GE(exact, boundedBest);
+                }
+                if (exact < exactBest) {
+                    exactBest = exact;
+                    exactIdx = j;
+                }
+                if (bounded < boundedBest) {
+                    boundedBest = bounded;
+                    boundedIdx = j;
+                }
+            }
+            EXPECT_EQ(boundedIdx, exactIdx);
+            EXPECT_DOUBLE_EQ(boundedBest, exactBest);
+        }
+    }
+}
+
+// ============================================================================
+// Lower Bound Pruning Tests
+// ============================================================================
+
+TEST_F(AudioTest, EnvelopeLowerBoundNeverExceedsDiffer) {
+    std::vector<std::unique_ptr<CSample>> samples;
+    for (uint i = 0; i < 16; ++i) {
+        samples.push_back(makeRampSample(1, i + 1, 9 + i, 0.45 * i));
+        samples.back()->prepare();
+    }
+    int positive = 0;
+    for (auto& a : samples) {
+        for (auto& b : samples) {
+            double exact = a->differ(*b);
+            double bound = a->lowerBound(*b);
+            if (!std::isnan(exact)) {
+                EXPECT_LE(bound, exact);
+            }
+            positive += bound > 0;
+        }
+    }
+    EXPECT_GT(positive, 0) << "The bound should not be trivially 0";
+}
+
+TEST_F(AudioTest, PrunedSearchFindsSameNearestNeighbour) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 40; ++i) {
+        learning.push_back(makeRampSample(1 + i % 4, i + 1, 12 + i % 7, 0.21 * i));
+        learning.back()->prepare();
+        raw.push_back(learning.back().get());
+    }
+    SPruningStats& stats = SPruningStats::getInstance();
+    stats.reset();
+    for (uint t = 0; t < 8; ++t) {
+        // Close to learning sample 5t
+        auto tested = makeRampSample(0, 100 + t, 14, 0.21 * 5 * t + 0.02);
+        CSample* expected = NULL;
+        double bestValue = 0.255;  // DIF_CUTOFF
+        for (CSample* l : raw) {
+            double tmp = tested->differ(*l);
+            if (tmp < bestValue) {
+                bestValue = tmp;
+                expected = l;
+            }
+        }
+        ASSERT_NE(expected, nullptr);
+        EXPECT_EQ(test(tested.get(), raw, false), expected);
+    }
+    EXPECT_EQ(stats.candidates.load(), 8u * raw.size());
+    RecordProperty("pruned_percent", (int)(100 * stats.pruned / stats.candidates));
+}
+
+// ============================================================================
+// Thread Pool Tests
+// ============================================================================
+
+TEST_F(AudioTest, ThreadPoolRunsEveryTask) {
+    CThreadPool pool(4);
+    EXPECT_EQ(pool.size(), 4u);
+    std::vector<std::future<long>> results;
+    for (long i = 0; i < 500; ++i) {
+        results.push_back(pool.submit([i]() { return i * i; }));
+    }
+    for (long i = 0; i < 500; ++i) {
+        EXPECT_EQ(results[i].get(), i * i);
+    }
+}
+
+TEST_F(AudioTest, ThreadPoolFinishesQueuedTasksOnDestruction) {
+    std::atomic<int> done(0);
+    {
+        CThreadPool pool(2);
+        for (int i = 0; i < 100; ++i) {
+            pool.submit([&done]() { ++done; });
+        }
+    }
+    EXPECT_EQ(done.load(), 100);
+}
+
+TEST_F(AudioTest, ParallelMatchingAgreesWithSerial) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 40; ++i) {
+        learning.push_back(makeRampSample(1 + i % 4, i + 1, 12 + i % 7, 0.21 * i));
+        learning.back()->prepare();
+        raw.push_back(learning.back().get());
+    }
+    std::vector<std::unique_ptr<CSample>> tested;
+    std::vector<CSample*> expected;
+    for (uint t = 0; t < 32; ++t) {
+        tested.push_back(makeRampSample(0, 100 + t, 10 + t % 9, 0.13 * t + 0.02));
+        expected.push_back(test(tested.back().get(), raw, false));
+    }
+    CThreadPool pool(4);
+    std::vector<std::future<CSample*>> found;
+    for (auto& sample : tested) {
+        CSample* s = sample.get();
+        found.push_back(pool.submit([s, &raw]() { return test(s, raw, false); }));
+    }
+    for (uint t = 0; t < tested.size(); ++t) {
+        EXPECT_EQ(found[t].get(), expected[t]) << "tested sample " << t;
+    }
+}
+
+// ============================================================================
+// Learning Matrix Tests
+// ============================================================================
+
+TEST_F(AudioTest, LearningMatrixRowsAreCacheLineAligned) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 5; ++i) {
+        learning.push_back(makeRampSample(1 + i, i + 1, 3 + i, 0.3 * i));
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    ASSERT_EQ(matrix.size(), raw.size());
+    for (size_t i = 0; i < matrix.size(); ++i) {
+        EXPECT_EQ(matrix.getFrameCount(i), raw[i]->getFreqCount());
+        EXPECT_EQ(matrix.getBirdId(i), raw[i]->getBirdId());
+        EXPECT_EQ(matrix.getId(i), raw[i]->getId());
+        EXPECT_EQ(matrix.getSample(i), raw[i]);
+        for (size_t f = 0; f < matrix.getFrameCount(i); ++f) {
+            EXPECT_EQ(reinterpret_cast<uintptr_t>(matrix.getFrame(i, f)) % CACHE_LINE, 0u);
+        }
+    }
+}
+
+TEST_F(AudioTest, LearningMatrixDifferMatchesSample) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 12; ++i) {
+        learning.push_back(makeRampSample(1 + i % 3, i + 1, 6 + i, 0.37 * i));
+        learning.back()->prepare();
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    for (uint t = 0; t < 6; ++t) {
+        auto tested = makeRampSample(0, 100 + t, 8 + 2 * t, 0.5 * t + 0.1);
+        for (size_t i = 0; i < matrix.size(); ++i) {
+            EXPECT_EQ(matrix.differ(*tested, i), tested->differ(*raw[i]));
+        }
+    }
+}
+
+TEST_F(AudioTest, LearningMatrixFindsSameNearestNeighbour) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 40; ++i) {
+        learning.push_back(makeRampSample(1 + i % 4, i + 1, 12 + i % 7, 0.21 * i));
+        learning.back()->prepare();
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    int found = 0;
+    for (uint t = 0; t < 16; ++t) {
+        auto tested = makeRampSample(0, 100 + t, 10 + t % 9, 0.13 * t + 0.02);
+        CSample* expected = test(tested.get(), raw, false);
+        EXPECT_EQ(test(tested.get(), matrix, false), expected);
+        found += expected != NULL;
+    }
+    EXPECT_GT(found, 0);
+}
+
+TEST_F(AudioTest, LearningMatrixSkipsIncompatibleLengths) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    // Added out of order; lengths 2..41
+    for (uint i = 0; i < 40; ++i) {
+        uint frames = 2 + (i * 17) % 40;
+        learning.push_back(makeRampSample(1 + i % 4, i + 1, frames, 0.21 * i));
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    for (size_t i = 1; i < matrix.size(); ++i) {
+        EXPECT_LE(matrix.getFrameCount(i - 1), matrix.getFrameCount(i));
+    }
+    SPruningStats& stats = SPruningStats::getInstance();
+    int found = 0;
+    for (uint t = 0; t < 12; ++t) {
+        auto tested = makeRampSample(0, 100 + t, 3 + 3 * t, 0.17 * t + 0.05);
+        size_t first, last;
+        matrix.compatibleRange(*tested, first, last);
+        for (size_t i = 0; i < matrix.size(); ++i) {
+            bool compatible = i >= first && i < last;
+            EXPECT_EQ(compatible, matrix.differ(*tested, i) != 1.2) << "frames " << matrix.getFrameCount(i);
+        }
+        stats.reset();
+        CSample* expected = test(tested.get(), raw, false);
+        EXPECT_EQ(test(tested.get(), matrix, false), expected);
+        EXPECT_EQ(stats.lengthSkipped.load(), matrix.size() - (last - first));
+        found += expected != NULL;
+    }
+    EXPECT_GT(found, 0);
+}
+
+// ============================================================================
+// Top-K Query Tests
+// ============================================================================
+
+TEST_F(AudioTest, NearestKMatchesFullSort) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 60; ++i) {
+        learning.push_back(makeRampSample(1 + i % 5, i + 1, 4 + (i * 7) % 30, 0.19 * i));
+        learning.back()->prepare();
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    for (uint t = 0; t < 8; ++t) {
+        auto tested = makeRampSample(0, 100 + t, 6 + 3 * t, 0.23 * t + 0.07);
+        std::vector<double> all;
+        for (size_t i = 0; i < matrix.size(); ++i) {
+            all.push_back(tested->differ(*matrix.getSample(i)));
+        }
+        std::sort(all.begin(), all.end());
+        for (size_t k : {1u, 5u, 100u}) {
+            std::vector<SNeighbour> best = matrix.nearestK(*tested, k);
+            ASSERT_EQ(best.size(), std::min(k, all.size()));
+            for (size_t j = 0; j < best.size(); ++j) {
+                EXPECT_DOUBLE_EQ(best[j].diff, all[j]) << "k=" << k << " j=" << j;
+                EXPECT_DOUBLE_EQ(best[j].diff, tested->differ(*matrix.getSample(best[j].index)));
+            }
+        }
+        std::vector<SNeighbour> below = matrix.nearestK(*tested, 100, 0.3);
+        size_t expected = std::lower_bound(all.begin(), all.end(), 0.3) - all.begin();
+        EXPECT_EQ(below.size(), expected);
+    }
+}
+
+TEST_F(AudioTest, NearestPerSpeciesMatchesFullScan) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 60; ++i) {
+        learning.push_back(makeRampSample(1 + i % 5, i + 1, 4 + (i * 7) % 30, 0.19 * i));
+        learning.back()->prepare();
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    for (uint t = 0; t < 8; ++t) {
+        auto tested = makeRampSample(0, 100 + t, 6 + 3 * t, 0.23 * t + 0.07);
+        std::map<uint, double> expected;
+        for (CSample* s : raw) {
+            double d = tested->differ(*s);
+            auto it = expected.find(s->getBirdId());
+            if (it == expected.end() || d < it->second) {
+                expected[s->getBirdId()] = d;
+            }
+        }
+        std::vector<SNeighbour> best = matrix.nearestPerSpecies(*tested);
+        ASSERT_EQ(best.size(), expected.size());
+        for (size_t j = 0; j < best.size(); ++j) {
+            uint birdId = matrix.getBirdId(best[j].index);
+            EXPECT_DOUBLE_EQ(best[j].diff, expected[birdId]);
+            if (j > 0) {
+                EXPECT_LE(best[j - 1].diff, best[j].diff);
+            }
+        }
+    }
+}
+
+// ============================================================================
+// Batch Query Tests
+// ============================================================================
+
+TEST_F(AudioTest, BatchNearestMatchesSingleQueries) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 300; ++i) {
+        // Long samples so that the references span several tiles
+        learning.push_back(makeRampSample(1 + i % 6, i + 1, 20 + (i * 13) % 60, 0.11 * i));
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    std::vector<std::unique_ptr<CSample>> queries;
+    std::vector<CSample*> tested;
+    for (uint t = 0; t < 37; ++t) {
+        queries.push_back(makeRampSample(0, 1000 + t, 10 + (t * 7) % 90, 0.31 * t + 0.04));
+        tested.push_back(queries.back().get());
+    }
+    std::vector<int> expected;
+    std::vector<double> expectedDiffs;
+    for (CSample* q : tested) {
+        double diff;
+        expected.push_back(matrix.nearest(*q, 0.255, &diff));
+        expectedDiffs.push_back(diff);
+    }
+    CThreadPool pool(3);
+    for (CThreadPool* p : {(CThreadPool*)nullptr, &pool}) {
+        std::vector<double> diffs;
+        std::vector<int> best = matrix.nearest(tested, 0.255, &diffs, p);
+        EXPECT_EQ(best, expected);
+        EXPECT_EQ(diffs, expectedDiffs);
+    }
+    EXPECT_GT(std::count_if(expected.begin(), expected.end(), [](int i) { return i >= 0; }), 0);
+}
+
+// ============================================================================
+// Approximate Index Tests
+// ============================================================================
+
+TEST_F(AudioTest, VPTreeCandidatesAreNearestEmbeddings) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 200; ++i) {
+        learning.push_back(makeRampSample(1 + i % 6, i + 1, 5 + (i * 13) % 40, 0.11 * i));
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    CVPTree index(matrix);
+    ASSERT_EQ(index.size(), matrix.size());
+    for (uint t = 0; t < 10; ++t) {
+        auto tested = makeRampSample(0, 1000 + t, 8 + 3 * t, 0.29 * t + 0.04);
+        float query[EMBEDDING_SIZE];
+        CVPTree::embed(*tested, query);
+        std::vector<float> all;
+        for (size_t i = 0; i < matrix.size(); ++i) {
+            float e[EMBEDDING_SIZE];
+            CVPTree::embed(*matrix.getSample(i), e);
+            float d = 0;
+            for (uint j = 0; j < EMBEDDING_SIZE; ++j) {
+                d += std::fabs(query[j] - e[j]);
+            }
+            all.push_back(d);
+        }
+        std::sort(all.begin(), all.end());
+        std::vector<SNeighbour> found = index.candidates(query, 15);
+        ASSERT_EQ(found.size(), 15u);
+        for (size_t j = 0; j < found.size(); ++j) {
+            EXPECT_FLOAT_EQ(found[j].diff, all[j]);
+        }
+    }
+}
+
+TEST_F(AudioTest, VPTreeWithAllCandidatesIsExact) {
+    std::vector<std::unique_ptr<CSample>> learning;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 120; ++i) {
+        learning.push_back(makeRampSample(1 + i % 6, i + 1, 5 + (i * 13) % 40, 0.11 * i));
+        raw.push_back(learning.back().get());
+    }
+    CLearningMatrix matrix(raw);
+    CVPTree index(matrix);
+    int found = 0;
+    for (uint t = 0; t < 20; ++t) {
+        auto tested = makeRampSample(0, 1000 + t, 8 + 2 * t, 0.13 * t + 0.04);
+        double exactDiff, annDiff;
+        int exact = matrix.nearest(*tested, 0.255, &exactDiff);
+        EXPECT_EQ(index.nearest(*tested, matrix.size(), 0.255, &annDiff), exact);
+        EXPECT_EQ(annDiff, exactDiff);
+        found += exact >= 0;
+    }
+    EXPECT_GT(found, 0);
+}
+
+// ============================================================================
+// Distance Matrix Tests
+// ============================================================================
+
+TEST_F(AudioTest, DistanceMatrixHoldsSymmetricDiffer) {
+    std::vector<std::unique_ptr<CSample>> samples;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 45; ++i) {
+        samples.push_back(makeRampSample(1 + i % 3, i + 1, 4 + (i * 11) % 25, 0.17 * i));
+        raw.push_back(samples.back().get());
+    }
+    CDistanceMatrix serial(raw);
+    CThreadPool pool(4);
+    CDistanceMatrix parallel(raw, &pool);
+    ASSERT_EQ(serial.size(), raw.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+        EXPECT_EQ(serial(i, i), 0.0f);
+        for (size_t j = 0; j < raw.size(); ++j) {
+            if (i == j) {
+                continue;
+            }
+            EXPECT_EQ(raw[i]->differ(*raw[j]), raw[j]->differ(*raw[i]));
+            EXPECT_EQ(serial(i, j), (float)raw[i]->differ(*raw[j]));
+            EXPECT_EQ(parallel(i, j), serial(i, j));
+        }
+    }
+}
+
+TEST_F(AudioTest, DistanceMatrixCacheRoundTrip) {
+    std::vector<std::unique_ptr<CSample>> samples;
+    std::vector<CSample*> raw;
+    for (uint i = 0; i < 30; ++i) {
+        samples.push_back(makeRampSample(1 + i % 3, i + 1, 4 + (i * 11) % 25, 0.17 * i));
+        raw.push_back(samples.back().get());
+    }
+    const std::string filename = ::testing::TempDir() + "bsc_test.dist";
+    std::remove(filename.c_str());
+    auto computed = CDistanceMatrix::cached(raw, filename.c_str());
+    ASSERT_TRUE(computed);
+    EXPECT_FALSE(computed->isMapped());
+    auto mapped = CDistanceMatrix::cached(raw, filename.c_str());
+    ASSERT_TRUE(mapped);
+    EXPECT_TRUE(mapped->isMapped());
+    ASSERT_EQ(mapped->size(), raw.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+        for (size_t j = 0; j < raw.size(); ++j) {
+            EXPECT_EQ((*mapped)(i, j), (*computed)(i, j));
+        }
+    }
+    // Different features: the stored matrix must not be used
+    auto changed = makeRampSample(1, 99, 7, 0.5);
+    std::vector<CSample*> other = raw;
+    other[3] = changed.get();
+    EXPECT_NE(CDistanceMatrix::hash(other), CDistanceMatrix::hash(raw));
+    EXPECT_FALSE(CDistanceMatrix::load(filename.c_str(), CDistanceMatrix::hash(other), other.size()));
+    EXPECT_FALSE(CDistanceMatrix::load(filename.c_str(), CDistanceMatrix::hash(raw), raw.size() - 1));
+    std::remove(filename.c_str());
+}
+
+// ============================================================================
+// Categorization Tests
+// ============================================================================
+
+TEST_F(AudioTest, CategorizeMatchesSinglePassPerSpecies) {
+    std::vector<std::unique_ptr<CSample>> owned;
+    std::vector<CSample*> samples;
+    for (uint i = 0; i < 80; ++i) {
+        owned.push_back(makeRampSample(1 + i % 4, i + 1, 6 + i % 5, 0.05 * (i % 23)));
+        samples.push_back(owned.back().get());
+    }
+    const double delta = 0.05;
+    // Reference: one pass over all samples, nearest category of the same species
+    std::vector<std::unique_ptr<CSample>> expected;
+    for (CSample* sample : samples) {
+        double bestValue = 100;
+        CSample* bestCat = NULL;
+        for (auto& category : expected) {
+            if (category->getBirdId() != sample->getBirdId()) {
+                continue;
+            }
+            double tmp = sample->differ(*category);
+            if (tmp < bestValue) {
+                bestValue = tmp;
+                bestCat = category.get();
+            }
+        }
+        if (bestCat == NULL || bestValue > delta) {
+            expected.push_back(std::make_unique<CSample>(*sample));
+        } else {
+            bestCat->consume(*sample);
+        }
+    }
+    ASSERT_GT(expected.size(), 4u);
+    ASSERT_LT(expected.size(), samples.size());
+    CThreadPool pool(3);
+    for (CThreadPool* p : {(CThreadPool*)nullptr, &pool}) {
+        auto categories = categorize(samples, delta, p);
+        ASSERT_EQ(categories.size(), expected.size());
+        for (size_t c = 0; c < categories.size(); ++c) {
+            EXPECT_EQ(categories[c]->getId(), expected[c]->getId());
+            EXPECT_EQ(categories[c]->getBirdId(), expected[c]->getBirdId());
+        }
+    }
+}
+
+TEST_F(AudioTest, ConsumeAveragesMembersFrameByFrame) {
+    auto a = makeRampSample(1, 1, 6, 0.0);
+    auto b = makeRampSample(1, 2, 4, 0.7);
+    auto c = makeRampSample(1, 3, 8, 1.9);
+    CSample category(*a);
+    category.prepare();
+    category.consume(*b);
+    category.consume(*c);
+    EXPECT_EQ(category.getWeight(), 3u);
+    ASSERT_EQ(category.getFreqCount(), 6u);
+    for (size_t f = 0; f < 6; ++f) {
+        for (uint i = 0; i < COUNT_FREQ; ++i) {
+            double sum = a->getFrequencies()[f].freq[i] + c->getFrequencies()[f].freq[i];
+            double count = 2;
+            if (f < 4) {
+                sum += b->getFrequencies()[f].freq[i];
+                count = 3;
+            }
+            EXPECT_NEAR(category.getFrequencies()[f].freq[i], sum / count, 1e-5);
+        }
+    }
+    // Prepared frames follow the merged means
+    auto fresh = std::make_unique<CSample>(category);
+    fresh->prepare();
+    EXPECT_NEAR(category.differ(*fresh), 0.0, 1e-9);
+
+    // Merging categories weighs each by its members
+    CSample other(*b);
+    other.consume(*b);
+    other.consume(*b);
+    CSample merged(*a);
+    merged.consume(other);
+    EXPECT_EQ(merged.getWeight(), 4u);
+    for (uint i = 0; i < COUNT_FREQ; ++i) {
+        double expected = (a->getFrequencies()[0].freq[i] + 3 * b->getFrequencies()[0].freq[i]) / 4;
+        EXPECT_NEAR(merged.getFrequencies()[0].freq[i], expected, 1e-5);
+        EXPECT_NEAR(merged.getFrequencies()[5].freq[i], a->getFrequencies()[5].freq[i], 1e-6);
+    }
+}
+
+// ============================================================================
+// Condensation Tests
+// ============================================================================
+
+TEST_F(AudioTest, CondenseKeepsConsistentSubset) {
+    std::vector<std::unique_ptr<CSample>> owned;
+    std::vector<CSample*> samples;
+    for (uint i = 0; i < 60; ++i) {
+        uint bird = 1 + i % 2;
+        owned.push_back(makeRampSample(bird, i + 1, 8, (bird == 1 ? 0.0 : 2.5) + 0.01 * (i % 17)));
+        samples.push_back(owned.back().get());
+    }
+    // Labelled as the second species, but among the first
+    owned.push_back(makeRampSample(2, 61, 8, 0.05));
+    samples.push_back(owned.back().get());
+    const double cutoff = 0.255;
+    CDistanceMatrix distances(samples);
+    size_t edited = 0;
+    std::vector<size_t> kept = condense(samples, distances, cutoff, nullptr, &edited);
+    EXPECT_EQ(edited, 1u);
+    ASSERT_FALSE(kept.empty());
+    EXPECT_LT(kept.size(), samples.size() / 4);
+    EXPECT_EQ(std::count(kept.begin(), kept.end(), samples.size() - 1), 0);
+    // Every sample left after editing is recognized by its nearest kept sample
+    for (size_t i = 0; i + 1 < samples.size(); ++i) {
+        size_t best = kept[0];
+        for (size_t j : kept) {
+            if (distances(i, j) < distances(i, best)) {
+                best = j;
+            }
+        }
+        EXPECT_EQ(samples[best]->getBirdId(), samples[i]->getBirdId());
+        EXPECT_LT(distances(i, best), cutoff);
+    }
+    CThreadPool pool(3);
+    EXPECT_EQ(condense(samples, distances, cutoff, &pool), kept);
+}